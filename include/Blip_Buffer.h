@@ -2,7 +2,10 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <memory_resource>
+#include <span>
 #include <system_error>
 #include "Blip_Buffer_impl.h"
 
@@ -10,11 +13,38 @@
 using blip_time_t = int;                   // Source clocks in current time frame
 using blip_sample_t = int16_t;             // 16-bit signed output sample
 int const blip_default_length = 1000 / 4;  // Default Blip_Buffer length (1/4 second)
+int const blip_buffer_alignment = 64;      // Alignment of memory Blip_Buffer allocates
 
 //// Sample buffer for band-limited synthesis
 
-class Blip_Buffer : public Blip_Buffer_ {
+// Buffer type that Blip_Synth<quality, range, Config> adds to. Blip_Buffer for
+// blip_default_config, so existing code keeps using Blip_Buffer everywhere.
+template <class Config>
+struct blip_buffer_type {
+  using type = Basic_Blip_Buffer<Config>;
+};
+template <>
+struct blip_buffer_type<blip_default_config> {
+  using type = Blip_Buffer;
+};
+
+// Sample buffer for a given blip_config_t. Blip_Buffer uses blip_default_config; other
+// configurations can be used side by side, with Blip_Synth<quality, range, Config>.
+// Blip_Buffer.cpp instantiates blip_default_config, blip_fast_config, and blip_stereo_config
+// (Stereo_Blip_Buffer). A stereo buffer counts and reads samples in left/right pairs, and
+// each Blip_Synth adding to it has its own pan gains.
+template <class Config>
+class Basic_Blip_Buffer {
  public:
+  using Buffer = typename blip_buffer_type<Config>::type;
+
+  // Sets where sample buffer is allocated from, so that many buffers can share one arena.
+  // Must be called before set_sample_rate(). Defaults to std::pmr::get_default_resource().
+  void memory_resource(std::pmr::memory_resource* resource);
+  [[nodiscard]] std::pmr::memory_resource* memory_resource() const {
+    return resource_;
+  }
+
   // Sets output sample rate and resizes and clears sample buffer
   std::error_condition set_sample_rate(int samples_per_sec, int msec_length = blip_default_length);
 
@@ -34,9 +64,27 @@ class Blip_Buffer : public Blip_Buffer_ {
   [[nodiscard]] int samples_avail() const;
 
   // Reads at most n samples to out [0 to n-1] and returns number actually read. If stereo
-  // is true, writes to out [0], out [2], out [4] etc. instead.
+  // is true, writes to out [0], out [2], out [4] etc. instead. Stereo_Blip_Buffer writes
+  // n pairs to out [0 to n*2-1].
   int read_samples(blip_sample_t out[], int n, bool stereo = false);
 
+  // Reads n samples from each of count buffers, writing samples from bufs [i] to out [i].
+  // Each buffer must have at least n samples available. Integrates several buffers in
+  // parallel, which is much faster than calling read_samples() on each in turn.
+  static void read_samples(Buffer* const bufs[], blip_sample_t* const out[], int count, int n);
+
+  // Same as read_samples(), but writes floating-point samples where 1.0 is full scale.
+  // Samples are not clamped, so the full headroom of the buffer is preserved.
+  int read_samples_float(float out[], int n, bool stereo = false);
+
+  // Reads at most n samples into memory supplied by sink, so they can be written straight
+  // into memory owned by someone else, such as the free region of a ring buffer. Sink is
+  // called as sink(wanted) with the number of samples still wanted, and returns a
+  // std::span<blip_sample_t> or std::span<float> to write some or all of them to. Reading
+  // stops early if it returns an empty span. Returns number of samples read.
+  template <class Sink>
+  int read_samples_to(Sink&& sink, int n);
+
   // More features
 
   // Sets flag that tells some Multi_Buffer types that sound was added to buffer,
@@ -44,11 +92,40 @@ class Blip_Buffer : public Blip_Buffer_ {
   // per time frame that sound was added. Not needed if not using Multi_Buffer.
   void set_modified() {
     modified_ = true;
+    if (tap_ != nullptr) {
+      tap_->set_modified();
+    }
   }
 
   // Sets high-pass filter frequency, from 0 to 20000 Hz, where higher values reduce bass more
   void bass_freq(int frequency);
 
+  // Enables ring mode, where removing samples only advances the read position instead of
+  // moving all remaining samples to the beginning of the buffer, so read_samples() and
+  // remove_samples() cost only the number of samples consumed. Uses twice the memory.
+  // Takes effect at the next set_sample_rate().
+  void ring_mode(bool enabled = true) {
+    ring_mode_ = enabled;
+  }
+
+  // Enables exact ratio mode, where the rounding error of the clock rate factor is carried
+  // across frames, so that the number of samples produced for a given number of clocks is
+  // exactly clocks * sample rate / clock rate, rounded down.
+  void exact_ratio(bool enabled = true);
+
+  // Adds buffer that also receives all amplitude changes added to this one with Blip_Synth's
+  // offset(), offset_inline(), update(), and offset_pcm(), and whose time frames are ended
+  // along with this one's. A tap can have a different sample rate, so one synthesis pass can
+  // produce output at several rates, but must have the same clock rate. Calls to
+  // set_modified() are passed on too, so a Tracked_Blip_Buffer can be a tap. See
+  // Blip_Synth::offset_resampled() for what doesn't reach taps.
+  void add_tap(Buffer* tap);
+
+  // Removes all taps
+  void remove_taps() {
+    tap_ = nullptr;
+  }
+
   [[nodiscard]] int length() const;           // Length of buffer in milliseconds
   [[nodiscard]] int sample_rate() const;      // Current output sample rate
   [[nodiscard]] int clock_rate() const;       // Number of source time units per second
@@ -70,75 +147,197 @@ class Blip_Buffer : public Blip_Buffer_ {
   // Mixes n samples into buffer
   void mix_samples(const blip_sample_t in[], int n);
 
+  // Adds deltas of all samples available in each of count source buffers to this one,
+  // scaled by gains [i] (or unscaled if gains is NULL), then removes them from the sources.
+  // Since deltas are linear until integrated, this buffer can then be read as the mix of
+  // all sources, integrating and high-pass filtering once instead of once per source.
+  // Sources must use the same sample and clock rate and must have been ended at the same
+  // time as this buffer. Sources are never read, so their own integrators are not used.
+  void mix_buffers(Buffer* const srcs[], double const gains[], int count);
+
   // Resampled time (sorry, poor documentation right now)
 
   // Resampled time is fixed-point, in terms of output samples.
 
+  // Properties of fixed-point sample position
+  using fixed_t = typename Config::resampled_time_t;              // unsigned for more range, optimized shifts
+  enum { fixed_bits = Config::accuracy };                          // bits in fraction
+  static constexpr fixed_t fixed_unit = (fixed_t)1 << fixed_bits;  // 1.0 samples
+
   // Converts clock count to resampled time
-  [[nodiscard]] blip_resampled_time_t resampled_duration(int t) const {
+  [[nodiscard]] fixed_t resampled_duration(int t) const {
     return t * factor_;
   }
 
   // Converts clock time since beginning of current time frame to resampled time
-  [[nodiscard]] blip_resampled_time_t resampled_time(blip_time_t t) const {
+  [[nodiscard]] fixed_t resampled_time(blip_time_t t) const {
     return t * factor_ + offset_;
   }
 
   // Returns factor that converts clock rate to resampled time
-  [[nodiscard]] blip_resampled_time_t clock_rate_factor(int clock_rate) const;
+  [[nodiscard]] fixed_t clock_rate_factor(int clock_rate) const;
 
   // State save/load
 
   // Saves state, including high-pass filter and tails of last deltas.
   // All samples must have been read from buffer before calling this
   // (that is, samples_avail() must return 0).
-  void save_state(blip_buffer_state_t* out);
+  void save_state(basic_blip_buffer_state_t<Config>* out);
 
   // Loads state. State must have been saved from Blip_Buffer with same
   // settings during same run of program; states can NOT be stored on disk.
   // Clears buffer before loading state.
-  void load_state(const blip_buffer_state_t& in);
+  void load_state(const basic_blip_buffer_state_t<Config>& in);
+
+  // Number of bytes capture_state() currently needs, which grows with samples_avail()
+  [[nodiscard]] size_t capture_size() const;
+
+  // Saves complete state, including unread samples, to out, which must have at least
+  // capture_size() bytes. Can be done at any time, so rollback doesn't require reading all
+  // samples first. Returns number of bytes written. The state is plain data that can be
+  // copied freely, but like save_state() it's only valid for a buffer with the same settings
+  // during the same run of program.
+  size_t capture_state(void* out);
+
+  // Restores state saved by capture_state(), where size is the number of bytes it returned
+  void restore_state(void const* in, size_t size);
+
+  // Writer, used by Blip_Synth
+
+  using clocks_t = int;
+
+  // Converts clock count to fixed-point sample position
+  [[nodiscard]] fixed_t to_fixed(clocks_t t) const {
+    return t * factor_ + offset_;
+  }
+
+  // Deltas in buffer are fixed-point with this many fraction bits.
+  // Less than 16 for extra range.
+  enum { delta_bits = 14 };
+
+  // Pointer to first committed delta sample
+  using delta_t = typename Config::delta_t;
+
+  // Pointer to delta corresponding to fixed-point sample position. With 2 channels, this is
+  // the left delta and the right delta follows it.
+  delta_t* delta_at(fixed_t /*f*/);
+
+  // Next buffer that also receives amplitude changes, or NULL. See add_tap().
+  [[nodiscard]] Buffer* next_tap() const {
+    return tap_;
+  }
+
+  // Reader, used by BLIP_READER_ macros and Multi_Buffer
+
+  delta_t* read_pos() {
+    return buffer_;
+  }
+
+  void clear_modified() {
+    modified_ = false;
+  }
+  [[nodiscard]] int highpass_shift() const {
+    return bass_shift_;
+  }
+  [[nodiscard]] int integrator(int channel = 0) const {
+    return reader_accum_[channel];
+  }
+  void set_integrator(int n, int channel = 0) {
+    reader_accum_[channel] = n;
+  }
+  [[nodiscard]] bool modified() const {
+    return modified_;
+  }
 
  private:
   // noncopyable
-  Blip_Buffer(const Blip_Buffer&) = delete;
-  Blip_Buffer& operator=(const Blip_Buffer&) = delete;
+  Basic_Blip_Buffer(const Basic_Blip_Buffer&) = delete;
+  Basic_Blip_Buffer& operator=(const Basic_Blip_Buffer&) = delete;
+
+  fixed_t factor_;
+  fixed_t offset_;
+  delta_t* buffer_center_;
+  int buffer_size_;  // in sample frames, as are other sizes
+  int reader_accum_[Config::channels];
+  int bass_shift_;
+  delta_t* buffer_;  // start of current window into storage_
+  delta_t* storage_;
+  int storage_size_;
+  int sample_rate_;
+  int clock_rate_;
+  int bass_freq_;
+  int length_;
+  bool modified_;
+  bool ring_mode_;
+  bool exact_ratio_;
+  int ratio_error_;  // exact resampled time per clock minus factor_, in units of 1/clock_rate_
+  int ratio_rem_;    // accumulated ratio_error_ not yet added to offset_
+  Buffer* tap_;
+  std::pmr::memory_resource* resource_;
+
+  void free_storage();
+  [[nodiscard]] fixed_t frame_duration(clocks_t t, int* rem_out = nullptr) const;
 
   // Implementation
  public:
-  Blip_Buffer();
-  ~Blip_Buffer();
+  Basic_Blip_Buffer();
+  explicit Basic_Blip_Buffer(std::pmr::memory_resource* resource);
+  ~Basic_Blip_Buffer();
   void remove_silence(int n);
 };
 
+class Blip_Buffer : public Basic_Blip_Buffer<blip_default_config> {
+ public:
+  using Basic_Blip_Buffer::Basic_Blip_Buffer;
+};
+
 //// Adds amplitude changes to Blip_Buffer
 
-template <int quality, int range>
+template <int quality, int range, class Config = blip_default_config>
 class Blip_Synth;
 
 using Blip_Synth_Fast = Blip_Synth<8, 1>;   // faster, but less equalizer control
 using Blip_Synth_Norm = Blip_Synth<12, 1>;  // good for most things
 using Blip_Synth_Good = Blip_Synth<16, 1>;  // sharper filter cutoff
 
-template <int quality, int range>
+template <int quality, int range, class Config>
 class Blip_Synth {
+  static_assert(Config::fast || quality <= Config::max_quality);  // fast ignores quality
+
  public:
+  using Buffer = typename blip_buffer_type<Config>::type;
+
   // Sets volume of amplitude delta unit
   void volume(double v) {
     impl.volume_unit(1.0 / range * v);
+    if constexpr (Config::channels == 2) {
+      update_pan();
+    }
+  }
+
+  // Sets left and right gains, relative to volume(), for stereo Blip_Buffer. Defaults to 1.0
+  // for both.
+  void pan(double left, double right) {
+    static_assert(Config::channels == 2);
+    pan_.gain[0] = left;
+    pan_.gain[1] = right;
+    update_pan();
   }
 
   // Configures low-pass filter
   void treble_eq(const blip_eq_t& eq) {
     impl.treble_eq(eq);
+    if constexpr (Config::channels == 2) {
+      update_pan();
+    }
   }
 
   // Gets/sets default Blip_Buffer
-  [[nodiscard]] Blip_Buffer* output() const {
-    return impl.buf;
+  [[nodiscard]] Buffer* output() const {
+    return buf;
   }
-  void output(Blip_Buffer* b) {
-    impl.buf = b;
+  void output(Buffer* b) {
+    buf = b;
     impl.last_amp = 0;
   }
 
@@ -152,38 +351,75 @@ class Blip_Synth {
 
   // Adds amplitude transition at time t. Delta can be positive or negative.
   // The actual change in amplitude is delta * volume.
-  void offset(blip_time_t t, int delta, Blip_Buffer* /*buf*/) const;
+  void offset(blip_time_t t, int delta, Buffer* /*buf*/) const;
   void offset(blip_time_t t, int delta) const {
-    offset(t, delta, impl.buf);
+    offset(t, delta, buf);
+  }
+
+  // Adds amplitude transition at time t only to taps of b, for callers that add it to b
+  // itself with offset_resampled()
+  void offset_taps(blip_time_t t, int delta, Buffer* b) const {
+    for (Buffer* tap = b->next_tap(); tap != nullptr; tap = tap->next_tap()) {
+      offset_resampled(tap->to_fixed(t), delta, tap);
+    }
   }
 
   // Same as offset(), except code is inlined for higher performance
-  void offset_inline(blip_time_t t, int delta, Blip_Buffer* buf) const {
-    offset_resampled(buf->to_fixed(t), delta, buf);
+  void offset_inline(blip_time_t t, int delta, Buffer* b) const {
+    offset_resampled(b->to_fixed(t), delta, b);
+    if (b->next_tap() != nullptr) {
+      offset_taps(t, delta, b);
+    }
   }
   void offset_inline(blip_time_t t, int delta) const {
-    offset_resampled(impl.buf->to_fixed(t), delta, impl.buf);
+    offset_inline(t, delta, buf);
   }
 
   // Works directly in terms of fractional output samples. Use resampled time functions in Blip_Buffer
-  // to convert clock counts to resampled time.
-  void offset_resampled(blip_resampled_time_t /*time*/, int delta, Blip_Buffer* /*blip_buf*/) const;
+  // to convert clock counts to resampled time. Resampled time is specific to blip_buf, so this
+  // doesn't add to its taps; use offset_taps() for that. Nes_Namco_Apu works entirely in
+  // resampled time, so its output doesn't reach taps.
+  void offset_resampled(typename Buffer::fixed_t /*time*/, int delta, Buffer* /*blip_buf*/) const;
+
+  // Adds amplitude changes for count samples of PCM, where in [i] is the amplitude at time
+  // t + i * period and last_amp is the amplitude before t. Returns in [count-1], to be
+  // passed as last_amp for the next block. Much faster than calling offset() for each sample.
+  int offset_pcm(blip_time_t t, int period, int const in[], int count, int last_amp, Buffer* b) const {
+    for (Buffer* tap = b->next_tap(); tap != nullptr; tap = tap->next_tap()) {
+      offset_pcm_resampled(tap->to_fixed(t), tap->resampled_duration(period), in, count, last_amp, tap);
+    }
+    return offset_pcm_resampled(b->to_fixed(t), b->resampled_duration(period), in, count, last_amp, b);
+  }
+
+  // Same as offset_pcm(), but samples are step apart in resampled time, so source rate need not
+  // be a whole number of clocks per sample. Use Blip_Buffer::clock_rate_factor( source_rate ) to
+  // get step for a source rate. Like offset_resampled(), this only adds to b, not its taps.
+  int offset_pcm_resampled(typename Buffer::fixed_t time,
+                           typename Buffer::fixed_t step,
+                           int const in[],
+                           int count,
+                           int last_amp,
+                           Buffer* b) const;
+
+ private:
+  void add_impulse(typename Buffer::delta_t* buf, int phase, int delta) const;
+  void add_impulse_stereo(typename Buffer::delta_t* buf, int phase, int left, int right) const;
+  void add_impulse_compact(typename Buffer::delta_t* buf, int phase, int delta) const;
+  void update_pan() {
+    pan_.delta_factor[0] = impl.scaled_delta_factor(pan_.gain[0]);
+    pan_.delta_factor[1] = impl.scaled_delta_factor(pan_.gain[1]);
+  }
 
   // Implementation
  private:
-#if BLIP_BUFFER_FAST
-  Blip_Synth_Fast_ impl;
-  typedef char coeff_t;
-#else
-  Blip_Synth_ impl;
-  using coeff_t = short;
-  // Left halves of first difference of step response for each possible phase
-  coeff_t phases[quality / 2 * blip_res]{};
+  std::conditional_t<Config::fast, Blip_Synth_Fast_, Blip_Synth_> impl;
+  using coeff_t = std::conditional_t<Config::fast, char, short>;
+  Buffer* buf{nullptr};
+  [[no_unique_address]] std::conditional_t<Config::channels == 2, blip_pan_t, blip_no_pan_t> pan_;
 
  public:
-  Blip_Synth() : impl(phases, quality) {
+  Blip_Synth() : impl(quality, Config::res) {
   }
-#endif
 };
 
 //// Low-pass equalization parameters
@@ -191,6 +427,7 @@ class Blip_Synth {
 class blip_eq_t {
   double treble, kaiser;
   int rolloff_freq, sample_rate, cutoff_freq;
+  friend class Blip_Synth_;
 
  public:
   // Logarithmic rolloff to treble dB at half sampling rate. Negative values reduce
@@ -204,9 +441,11 @@ class blip_eq_t {
   virtual void generate(float out[], int count) const;
   virtual ~blip_eq_t() = default;
 
+  // generate() is in terms of this resolution. Blip_Synths with other phase bits use
+  // their own resolution, but only for blip_eq_t itself, not derived classes.
   enum { oversample = blip_res };
-  static int calc_count(int quality) {
-    return (quality - 1) * (oversample / 2) + 1;
+  static constexpr int calc_count(int quality, int res = oversample) {
+    return (quality - 1) * (res / 2) + 1;
   }
 };
 
@@ -3,23 +3,37 @@
 #pragma once
 
 #include <cassert>
-
-using blip_resampled_time_t = unsigned int;
+#include <compare>
+#include <memory>
+#include <cstdint>
+#include <type_traits>
+#include "Blip_Simd.h"
+
+// Use 64-bit resampled time, which removes the ~65000 sample limit on buffer length and
+// gives clock rate factors 16 more bits of precision
+#ifndef BLIP_BUFFER_64BIT_TIME
+#define BLIP_BUFFER_64BIT_TIME 0
+#endif
 
 #ifndef BLIP_MAX_QUALITY
 #define BLIP_MAX_QUALITY 32
 #endif
 
 #ifndef BLIP_BUFFER_ACCURACY
+#if BLIP_BUFFER_64BIT_TIME
+#define BLIP_BUFFER_ACCURACY 32
+#else
 #define BLIP_BUFFER_ACCURACY 16
 #endif
+#endif
 
 #ifndef BLIP_PHASE_BITS
 #define BLIP_PHASE_BITS 6
 #endif
 
-class blip_eq_t;
-class Blip_Buffer;
+#ifndef BLIP_BUFFER_FAST
+#define BLIP_BUFFER_FAST 0
+#endif
 
 #if BLIP_BUFFER_FAST
 // linear interpolation needs 8 bits
@@ -30,121 +44,155 @@ class Blip_Buffer;
 #define BLIP_MAX_QUALITY 2
 #endif
 
-int const blip_res = 1 << BLIP_PHASE_BITS;
-int const blip_buffer_extra_ = BLIP_MAX_QUALITY + 2;
-
-class Blip_Buffer_ {
- public:
-  // Writer
-
-  using clocks_t = int;
-
-  // Properties of fixed-point sample position
-  using fixed_t = unsigned int;                // unsigned for more range, optimized shifts
-  enum { fixed_bits = BLIP_BUFFER_ACCURACY };  // bits in fraction
-  enum { fixed_unit = 1 << fixed_bits };       // 1.0 samples
-
-  // Converts clock count to fixed-point sample position
-  [[nodiscard]] fixed_t to_fixed(clocks_t t) const {
-    return t * factor_ + offset_;
-  }
-
-  // Deltas in buffer are fixed-point with this many fraction bits.
-  // Less than 16 for extra range.
-  enum { delta_bits = 14 };
+// Compile-time settings shared by a Blip_Buffer and the Blip_Synths that add to it. Fast
+// uses linear interpolation instead of band-limited steps, which needs 8 phase bits and a
+// maximum quality of 2. With 2 channels, deltas are stored as interleaved left/right pairs.
+// A non-zero delta shift stores deltas in 16 bits, with that many low bits removed and
+// saturating at the 16-bit range; see blip_compact_config.
+template <int accuracy_,
+          int phase_bits_,
+          int max_quality_,
+          bool fast_,
+          bool wide_time_,
+          int channels_ = 1,
+          int delta_shift_ = 0>
+struct blip_config_t {
+  static_assert(!fast_ || (phase_bits_ == 8 && max_quality_ == 2));
+  static_assert(channels_ == 1 || (channels_ == 2 && !fast_));
+  static_assert(delta_shift_ == 0 || (channels_ == 1 && !fast_));
+
+  static constexpr int accuracy = accuracy_;        // bits in fraction of resampled time
+  static constexpr int phase_bits = phase_bits_;    // sub-sample resolution of synthesis
+  static constexpr int max_quality = max_quality_;  // widest Blip_Synth quality
+  static constexpr bool fast = fast_;
+  static constexpr int channels = channels_;
+  static constexpr int delta_shift = delta_shift_;
+  static constexpr int res = 1 << phase_bits;
+  static constexpr int buffer_extra = max_quality + 2;
+
+  using resampled_time_t = std::conditional_t<wide_time_, uint64_t, unsigned int>;
+  using delta_t = std::conditional_t<(delta_shift_ > 0), int16_t, int>;
+};
 
-  // Pointer to first committed delta sample
-  using delta_t = int;
+// Settings given by the BLIP_ macros, used by Blip_Buffer and the sound chips
+using blip_default_config = blip_config_t<BLIP_BUFFER_ACCURACY,
+                                          BLIP_PHASE_BITS,
+                                          BLIP_MAX_QUALITY,
+                                          BLIP_BUFFER_FAST,
+                                          BLIP_BUFFER_64BIT_TIME>;
 
-  // Pointer to delta corresponding to fixed-point sample position
-  delta_t* delta_at(fixed_t /*f*/);
+// Linear interpolation, for cheap renders that don't need band-limiting
+#if BLIP_BUFFER_FAST
+using blip_fast_config = blip_default_config;
+#else
+using blip_fast_config = blip_config_t<BLIP_BUFFER_ACCURACY, 8, 2, true, BLIP_BUFFER_64BIT_TIME>;
+#endif
 
-  // Reader
+// Stereo with interleaved deltas, where each Blip_Synth has its own left and right gains
+#if BLIP_BUFFER_FAST
+using blip_stereo_config = blip_config_t<BLIP_BUFFER_ACCURACY, 6, 32, false, BLIP_BUFFER_64BIT_TIME, 2>;
+#else
+using blip_stereo_config =
+    blip_config_t<BLIP_BUFFER_ACCURACY, BLIP_PHASE_BITS, BLIP_MAX_QUALITY, false, BLIP_BUFFER_64BIT_TIME, 2>;
+#endif
 
-  delta_t* read_pos() {
-    return buffer_;
-  }
+// Half the memory of blip_default_config, using 16-bit deltas in units of 1/4 of a 16-bit
+// output sample. Deltas saturate for amplitude steps larger than about a fifth of full scale,
+// so this is meant for low-amplitude channels such as a single sound chip's. See README.
+#if BLIP_BUFFER_FAST
+using blip_compact_config = blip_config_t<BLIP_BUFFER_ACCURACY, 6, 32, false, BLIP_BUFFER_64BIT_TIME, 1, 12>;
+#else
+using blip_compact_config =
+    blip_config_t<BLIP_BUFFER_ACCURACY, BLIP_PHASE_BITS, BLIP_MAX_QUALITY, false, BLIP_BUFFER_64BIT_TIME, 1, 12>;
+#endif
 
-  void clear_modified() {
-    modified_ = false;
-  }
-  [[nodiscard]] int highpass_shift() const {
-    return bass_shift_;
-  }
-  [[nodiscard]] int integrator() const {
-    return reader_accum_;
-  }
-  void set_integrator(int n) {
-    reader_accum_ = n;
-  }
+using blip_resampled_time_t = blip_default_config::resampled_time_t;
 
-  // friend class Tracked_Blip_Buffer; private:
-  [[nodiscard]] bool modified() const {
-    return modified_;
-  }
-  void remove_silence(int count);
+class blip_eq_t;
+template <class Config>
+class Basic_Blip_Buffer;
+class Blip_Buffer;
+using Stereo_Blip_Buffer = Basic_Blip_Buffer<blip_stereo_config>;
+using Compact_Blip_Buffer = Basic_Blip_Buffer<blip_compact_config>;
 
- private:
-  unsigned factor_;
-  fixed_t offset_;
-  delta_t* buffer_center_;
-  int buffer_size_;
-  int reader_accum_;
-  int bass_shift_;
-  delta_t* buffer_;
-  int sample_rate_;
-  int clock_rate_;
-  int bass_freq_;
-  int length_;
-  bool modified_;
-
-  friend class Blip_Buffer;
-};
+int const blip_res = blip_default_config::res;
 
 class Blip_Synth_Fast_ {
  public:
   int delta_factor{0};
   int last_amp{0};
-  Blip_Buffer* buf{nullptr};
 
   void volume_unit(double /*new_unit*/);
   void treble_eq(blip_eq_t const& /*unused*/) {
   }
-  Blip_Synth_Fast_();
+  Blip_Synth_Fast_(int /*width*/, int /*res*/) {
+  }
 };
 
 class Blip_Synth_ {
  public:
   int delta_factor;
   int last_amp;
-  Blip_Buffer* buf;
+
+  // Left halves of first difference of step response for each possible phase. Kernels
+  // for the same width, resolution, eq and volume are shared between all synths.
+  short const* phases;
 
   void volume_unit(double /*new_unit*/);
   void treble_eq(blip_eq_t const& /*eq*/);
-  Blip_Synth_(short phases[], int width);
+  Blip_Synth_(int width, int res);
+
+  // Same as delta_factor, for volume unit times gain
+  [[nodiscard]] int scaled_delta_factor(double gain) const;
 
  private:
+  struct kernel_key_t {
+    double treble, kaiser;
+    int rolloff_freq, sample_rate, cutoff_freq;
+    int width, res, shift;
+    auto operator<=>(kernel_key_t const&) const = default;
+  };
+
   double volume_unit_;
-  short* const phases;
+  std::shared_ptr<short[]> kernel_;
+  kernel_key_t key_;
+  bool cached_;
   int const width;
+  int const res;
   int kernel_unit;
 
-  void adjust_impulse();
-  void rescale_kernel(int shift);
+  void use_cached_kernel(kernel_key_t const& /*key*/);
   [[nodiscard]] int impulses_size() const {
-    return blip_res / 2 * width;
+    return res / 2 * width;
   }
 };
 
-class blip_buffer_state_t {
-  blip_resampled_time_t offset_;
-  int reader_accum_;
-  int buf[blip_buffer_extra_];
-  friend class Blip_Buffer;
+// Left and right gains of a Blip_Synth adding to a stereo Blip_Buffer
+struct blip_pan_t {
+  double gain[2] = {1.0, 1.0};
+  int delta_factor[2] = {0, 0};
 };
+struct blip_no_pan_t {};
 
-inline Blip_Buffer_::delta_t* Blip_Buffer_::delta_at(fixed_t f) {
-  assert((f >> fixed_bits) < (unsigned)buffer_size_);
-  return buffer_center_ + (f >> fixed_bits);
+// Adds n to delta. Compact deltas saturate at their range.
+inline int blip_add_delta(int d, int n) {
+  return d + n;
 }
+inline int16_t blip_add_delta(int16_t d, int n) {
+  n += d;
+  if ((int16_t)n != n) {
+    n = (n >> 31) ^ 0x7FFF;
+  }
+  return (int16_t)n;
+}
+
+template <class Config>
+class basic_blip_buffer_state_t {
+  typename Config::resampled_time_t offset_;
+  int ratio_rem_;
+  int reader_accum_[Config::channels];
+  typename Config::delta_t buf[Config::buffer_extra * Config::channels];
+  friend class Basic_Blip_Buffer<Config>;
+};
 
+using blip_buffer_state_t = basic_blip_buffer_state_t<blip_default_config>;
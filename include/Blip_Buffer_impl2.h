@@ -8,6 +8,9 @@
 // -1 << (blip_sample_bits-1) = -1.0
 int const blip_sample_bits = 30;
 
+// Converts raw sample to floating-point, where 1.0 corresponds to full 16-bit output range
+float const blip_sample_float_scale = 1.0f / (1 << (blip_sample_bits - 1));
+
 //// BLIP_READER_
 
 //// Optimized reading from Blip_Buffer, for use in custom sample buffer or mixer
@@ -76,57 +79,79 @@ int const blip_reader_idx_factor = sizeof(Blip_Buffer::delta_t);
 // (in >> sh & mask) * mul
 #define BLIP_SH_AND_MUL(in, sh, mask, mul) ((int)(in) / ((1U << (sh)) / (mul)) & (unsigned)((mask) * (mul)))
 
+// Same for 64-bit time, which doesn't fit in int, so it's shifted instead
+#define BLIP_SH_AND_MUL_WIDE(in, sh, mask, mul) ((int)((in) >> (sh)) * (int)(mul) & (int)((mask) * (mul)))
+
 // (T*) ptr + (off >> sh)
 #define BLIP_PTR_OFF_SH(T, ptr, off, sh) ((T*)(BLIP_SH_AND_MUL(off, sh, -1, sizeof(T)) + (char*)(ptr)))
 
-template <int quality, int range>
-inline void Blip_Synth<quality, range>::offset_resampled(blip_resampled_time_t time,
-                                                         int delta,
-                                                         Blip_Buffer* blip_buf) const {
-#if BLIP_BUFFER_FAST
-  int const half_width = 1;
-#else
-  int const half_width = quality / 2;
-#endif
-
-  Blip_Buffer::delta_t* __restrict buf = blip_buf->delta_at(time);
-
-  delta *= impl.delta_factor;
-
-  int const phase_shift = BLIP_BUFFER_ACCURACY - BLIP_PHASE_BITS;
-  int const phase = ((half_width & (half_width - 1)) != 0)
-                        ? (int)BLIP_SH_AND_MUL(time, phase_shift, blip_res - 1, sizeof(coeff_t)) * half_width
-                        : (int)BLIP_SH_AND_MUL(time, phase_shift, blip_res - 1, sizeof(coeff_t) * half_width);
+template <int quality, int range, class Config>
+inline void Blip_Synth<quality, range, Config>::offset_resampled(typename Buffer::fixed_t time,
+                                                                 int delta,
+                                                                 Buffer* blip_buf) const {
+  int const half_width = (Config::fast ? 1 : quality / 2);
+  int const blip_res = Config::res;
+
+  typename Buffer::delta_t* __restrict buf = blip_buf->delta_at(time);
+
+  int const phase_shift = Config::accuracy - Config::phase_bits;
+  int phase = 0;
+  if constexpr (sizeof time > sizeof(int)) {
+    phase = ((half_width & (half_width - 1)) != 0)
+                ? (int)BLIP_SH_AND_MUL_WIDE(time, phase_shift, blip_res - 1, sizeof(coeff_t)) * half_width
+                : (int)BLIP_SH_AND_MUL_WIDE(time, phase_shift, blip_res - 1, sizeof(coeff_t) * half_width);
+  } else {
+    phase = ((half_width & (half_width - 1)) != 0)
+                ? (int)BLIP_SH_AND_MUL(time, phase_shift, blip_res - 1, sizeof(coeff_t)) * half_width
+                : (int)BLIP_SH_AND_MUL(time, phase_shift, blip_res - 1, sizeof(coeff_t) * half_width);
+  }
 
-#if BLIP_BUFFER_FAST
-  int left = buf[0] + delta;
+  if constexpr (Config::fast) {
+    delta *= impl.delta_factor;
+    int left = buf[0] + delta;
 
-  // Kind of crappy, but doing shift after multiply results in overflow.
-  // Alternate way of delaying multiply by delta_factor results in worse
-  // sub-sample resolution.
-  int right = (delta >> BLIP_PHASE_BITS) * phase;
+    // Kind of crappy, but doing shift after multiply results in overflow.
+    // Alternate way of delaying multiply by delta_factor results in worse
+    // sub-sample resolution.
+    int right = (delta >> Config::phase_bits) * phase;
 #if BLIP_BUFFER_NOINTERP
-  // TODO: remove? (just a hack to see how it sounds)
-  right = 0;
+    // TODO: remove? (just a hack to see how it sounds)
+    right = 0;
 #endif
-  left -= right;
-  right += buf[1];
-
-  buf[0] = left;
-  buf[1] = right;
-#else
+    left -= right;
+    right += buf[1];
+
+    buf[0] = left;
+    buf[1] = right;
+  } else if constexpr (Config::delta_shift > 0) {
+    add_impulse_compact(buf, phase, delta * impl.delta_factor);
+  } else if constexpr (Config::channels == 2) {
+    add_impulse_stereo(buf, phase, delta * pan_.delta_factor[0], delta * pan_.delta_factor[1]);
+  } else {
+    add_impulse(buf, phase, delta * impl.delta_factor);
+  }
+}
 
-  int const fwd = -quality / 2;
-  int const rev = fwd + quality - 2;
+template <int quality, int range, class Config>
+inline void Blip_Synth<quality, range, Config>::add_impulse(typename Buffer::delta_t* __restrict buf,
+                                                            int phase,
+                                                            int delta) const {
+  int const half_width = quality / 2;
+  int const blip_res = Config::res;
 
-  auto const* __restrict imp = (coeff_t const*)((char const*)phases + phase);
+  auto const* __restrict imp = (coeff_t const*)((char const*)impl.phases + phase);
   int const phase2 = phase + phase - (blip_res - 1) * half_width * sizeof(coeff_t);
 
 #define BLIP_MID_IMP imp = (coeff_t const*)((char const*)imp - phase2);
 
-#if BLIP_MAX_QUALITY > 16
+#if BLIP_SIMD_INLINE
+  blip_add_impulse_inline<half_width>(buf - half_width, imp, (coeff_t const*)((char const*)imp - phase2), delta);
+#else
+  int const fwd = -quality / 2;
+  int const rev = fwd + quality - 2;
+
   // General version for any quality
-  if (quality != 8 && quality != 12 && quality != 16) {
+  if constexpr (quality != 8 && quality != 12 && quality != 16) {
     buf += fwd;
 
     // left half
@@ -147,7 +172,6 @@ inline void Blip_Synth<quality, range>::offset_resampled(blip_resampled_time_t t
 
     return;
   }
-#endif
 
   // Unrolled versions for qualities 8, 12, and 16
 
@@ -227,27 +251,97 @@ inline void Blip_Synth<quality, range>::offset_resampled(blip_resampled_time_t t
   buf[rev + 1] = t1;
 #endif
 
-#endif
+#endif  // BLIP_SIMD_INLINE
 }
 
-template <int quality, int range>
-#if BLIP_BUFFER_FAST
-inline
-#endif
-    void
-    Blip_Synth<quality, range>::offset(blip_time_t t, int delta, Blip_Buffer* buf) const {
-  offset_resampled(buf->to_fixed(t), delta, buf);
+// Adds impulse to both channels of interleaved left/right deltas
+template <int quality, int range, class Config>
+inline void Blip_Synth<quality, range, Config>::add_impulse_stereo(typename Buffer::delta_t* __restrict buf,
+                                                                   int phase,
+                                                                   int left,
+                                                                   int right) const {
+  int const half_width = quality / 2;
+  int const blip_res = Config::res;
+
+  auto const* __restrict fwd = (coeff_t const*)((char const*)impl.phases + phase);
+  auto const* __restrict rev =
+      (coeff_t const*)((char const*)fwd - (phase + phase - (blip_res - 1) * half_width * sizeof(coeff_t)));
+
+  buf -= quality / 2 * 2;
+  for (int n = 0; n < half_width; n++) {
+    buf[0] += fwd[n] * left;
+    buf[1] += fwd[n] * right;
+    buf += 2;
+  }
+  for (int n = half_width; --n >= 0;) {
+    buf[0] += rev[n] * left;
+    buf[1] += rev[n] * right;
+    buf += 2;
+  }
 }
 
-template <int quality, int range>
-#if BLIP_BUFFER_FAST
-inline
-#endif
-    void
-    Blip_Synth<quality, range>::update(blip_time_t t, int amp) {
+// Adds impulse to compact deltas, rounding and saturating each one.
+template <int quality, int range, class Config>
+inline void Blip_Synth<quality, range, Config>::add_impulse_compact(typename Buffer::delta_t* __restrict buf,
+                                                                    int phase,
+                                                                    int delta) const {
+  int const half_width = quality / 2;
+  int const blip_res = Config::res;
+  int const shift = Config::delta_shift;
+  int const round = 1 << (shift - 1);
+
+  auto const* __restrict fwd = (coeff_t const*)((char const*)impl.phases + phase);
+  auto const* __restrict rev =
+      (coeff_t const*)((char const*)fwd - (phase + phase - (blip_res - 1) * half_width * sizeof(coeff_t)));
+
+  // Running sum is rounded rather than each term, so that rounding errors don't add up to
+  // a step of the wrong size
+  int sum = 0;
+  int prev = 0;
+  buf -= quality / 2;
+  for (int n = 0; n < half_width; n++) {
+    sum += fwd[n] * delta;
+    int const rounded = (sum + round) >> shift;
+    buf[n] = blip_add_delta(buf[n], rounded - prev);
+    prev = rounded;
+  }
+  buf += half_width;
+  for (int n = 0; n < half_width; n++) {
+    sum += rev[half_width - 1 - n] * delta;
+    int const rounded = (sum + round) >> shift;
+    buf[n] = blip_add_delta(buf[n], rounded - prev);
+    prev = rounded;
+  }
+}
+
+template <int quality, int range, class Config>
+int Blip_Synth<quality, range, Config>::offset_pcm_resampled(typename Buffer::fixed_t time,
+                                                             typename Buffer::fixed_t step,
+                                                             int const in[],
+                                                             int count,
+                                                             int last_amp,
+                                                             Buffer* b) const {
+  for (int i = 0; i < count; i++) {
+    int const delta = in[i] - last_amp;
+    if (delta != 0) {
+      last_amp = in[i];
+      offset_resampled(time, delta, b);
+    }
+    time += step;
+  }
+  return last_amp;
+}
+
+template <int quality, int range, class Config>
+void Blip_Synth<quality, range, Config>::offset(blip_time_t t, int delta, Buffer* b) const {
+  offset_inline(t, delta, b);
+}
+
+template <int quality, int range, class Config>
+void Blip_Synth<quality, range, Config>::update(blip_time_t t, int amp) {
   int delta = amp - impl.last_amp;
   impl.last_amp = amp;
-  offset_resampled(impl.buf->to_fixed(t), delta, impl.buf);
+  offset_inline(t, delta, buf);
 }
 
 //// blip_eq_t
@@ -260,28 +354,59 @@ inline blip_eq_t::blip_eq_t(double t, int rf, int sr, int cf, double k)
 
 //// Blip_Buffer
 
-inline int Blip_Buffer::length() const {
+template <class Config>
+inline int Basic_Blip_Buffer<Config>::length() const {
   return length_;
 }
-inline int Blip_Buffer::samples_avail() const {
-  return (int)(offset_ >> BLIP_BUFFER_ACCURACY);
+template <class Config>
+inline int Basic_Blip_Buffer<Config>::samples_avail() const {
+  return (int)(offset_ >> Config::accuracy);
 }
-inline int Blip_Buffer::sample_rate() const {
+template <class Config>
+inline int Basic_Blip_Buffer<Config>::sample_rate() const {
   return sample_rate_;
 }
-inline int Blip_Buffer::output_latency() {
-  return BLIP_MAX_QUALITY / 2;
+template <class Config>
+inline int Basic_Blip_Buffer<Config>::output_latency() {
+  return Config::max_quality / 2;
 }
-inline int Blip_Buffer::clock_rate() const {
+template <class Config>
+inline int Basic_Blip_Buffer<Config>::clock_rate() const {
   return clock_rate_;
 }
-inline void Blip_Buffer::clock_rate(int cps) {
-  factor_ = clock_rate_factor(clock_rate_ = cps);
+
+template <class Config>
+template <class Sink>
+int Basic_Blip_Buffer<Config>::read_samples_to(Sink&& sink, int n) {
+  n = std::min(n, samples_avail());
+  int count = 0;
+  while (count < n) {
+    auto const region = sink(n - count);
+    int const size = std::min((int)(region.size() / Config::channels), n - count);
+    if (size <= 0) {
+      break;
+    }
+    using sample_t = std::remove_cv_t<typename decltype(region)::element_type>;
+    if constexpr (std::is_same_v<sample_t, float>) {
+      read_samples_float(region.data(), size);
+    } else {
+      static_assert(std::is_same_v<sample_t, blip_sample_t>);
+      read_samples(region.data(), size);
+    }
+    count += size;
+  }
+  return count;
 }
 
-inline void Blip_Buffer::remove_silence(int count) {
+template <class Config>
+inline void Basic_Blip_Buffer<Config>::remove_silence(int count) {
   // fails if you try to remove more samples than available
   assert(count <= samples_avail());
-  offset_ -= (blip_resampled_time_t)count << BLIP_BUFFER_ACCURACY;
+  offset_ -= (fixed_t)count << Config::accuracy;
 }
 
+template <class Config>
+inline typename Basic_Blip_Buffer<Config>::delta_t* Basic_Blip_Buffer<Config>::delta_at(fixed_t f) {
+  assert((f >> fixed_bits) < (unsigned)buffer_size_);
+  return buffer_center_ + (f >> fixed_bits) * Config::channels;
+}
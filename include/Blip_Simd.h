@@ -0,0 +1,100 @@
+// SIMD versions of Blip_Synth impulse addition
+
+#pragma once
+
+// Blip_Synth adds impulses using SSE4.1/AVX2 or NEON when the compiler targets them, which
+// on x86 requires -msse4.1 or -mavx2 (the NES_SND_EMU_SIMD CMake option). SSE2 alone isn't
+// used, as it has no 32-bit multiply. Define as 0 to always use plain C++.
+#ifndef BLIP_BUFFER_SIMD
+#define BLIP_BUFFER_SIMD 1
+#endif
+
+#if BLIP_BUFFER_SIMD && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define BLIP_SIMD_SSE2 1
+#endif
+
+#if BLIP_BUFFER_SIMD && (defined(__SSE4_1__) || defined(__AVX2__))
+#define BLIP_SIMD_SSE4 1
+#include <immintrin.h>
+#elif BLIP_BUFFER_SIMD && (defined(__ARM_NEON) || defined(_M_ARM64))
+#define BLIP_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Number of buffers blip_integrate_lanes() integrates at once
+int const blip_lane_count = 4;
+
+// Integrates count deltas from each of in [0] to in [blip_lane_count-1] the same way
+// Blip_Buffer::read_samples() does, writing clamped 16-bit samples to the corresponding out
+// arrays. Uses and updates integrators in sums []. Integrators all use the same bass shift,
+// and are run in parallel since each only depends on its own previous value.
+void blip_integrate_lanes(int const* const in[], short* const out[], int sums[], int bass, int count);
+
+// Integrates left, right, and center deltas in in [0], in [1], and in [2] in parallel, writing
+// clamped left + center and right + center sample pairs to out. Uses and updates sums [0] to
+// sums [2].
+void blip_integrate_stereo(int const* const in[], short out[], int sums[], int bass, int count);
+
+#if BLIP_SIMD_SSE4 || BLIP_SIMD_NEON
+
+#define BLIP_SIMD_INLINE 1
+
+// Adds delta times impulse to buf, where left half of impulse is fwd [0] to fwd [half_width-1]
+// and right half is rev [half_width-1] down to rev [0]. Inlined into Blip_Synth, using
+// instructions the compiler was told it can use. Results are identical to the plain C++
+// version.
+template <int half_width>
+inline void blip_add_impulse_inline(int* buf, short const* fwd, short const* rev, int delta) {
+  int const tail = half_width & 3;
+
+#if BLIP_SIMD_SSE4
+#ifdef __AVX2__
+  if constexpr (half_width == 8) {
+    // each half of kernel fits in one register
+    __m256i const vdelta = _mm256_set1_epi32(delta);
+    __m256i const left = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i const*)fwd));
+    __m256i right = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i const*)rev));
+    right = _mm256_permutevar8x32_epi32(right, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+
+    auto* out = (__m256i*)buf;
+    _mm256_storeu_si256(out, _mm256_add_epi32(_mm256_loadu_si256(out), _mm256_mullo_epi32(left, vdelta)));
+    ++out;
+    _mm256_storeu_si256(out, _mm256_add_epi32(_mm256_loadu_si256(out), _mm256_mullo_epi32(right, vdelta)));
+    return;
+  }
+#endif
+  __m128i const vdelta = _mm_set1_epi32(delta);
+#define BLIP_SIMD_LOAD4(in) _mm_cvtepi16_epi32(_mm_loadl_epi64((__m128i const*)(in)))
+#define BLIP_SIMD_REV4(in) _mm_shuffle_epi32(BLIP_SIMD_LOAD4(in), _MM_SHUFFLE(0, 1, 2, 3))
+#define BLIP_SIMD_MADD4(out, imp) \
+  _mm_storeu_si128((__m128i*)(out), \
+                   _mm_add_epi32(_mm_loadu_si128((__m128i const*)(out)), _mm_mullo_epi32((imp), vdelta)))
+#else
+#define BLIP_SIMD_LOAD4(in) vmovl_s16(vld1_s16(in))
+#define BLIP_SIMD_REV4(in) vmovl_s16(vrev64_s16(vld1_s16(in)))
+#define BLIP_SIMD_MADD4(out, imp) vst1q_s32((out), vmlaq_n_s32(vld1q_s32(out), (imp), delta))
+#endif
+
+  int i = 0;
+  for (; i < half_width - tail; i += 4) {
+    BLIP_SIMD_MADD4(buf + i, BLIP_SIMD_LOAD4(fwd + i));
+  }
+  for (; i < half_width; i++) {
+    buf[i] += fwd[i] * delta;
+  }
+
+  // mirrored right half, starting with odd coefficients at end of rev
+  buf += half_width;
+  for (i = tail; --i >= 0;) {
+    *buf++ += rev[half_width - tail + i] * delta;
+  }
+  for (i = half_width - tail; (i -= 4) >= 0; buf += 4) {
+    BLIP_SIMD_MADD4(buf, BLIP_SIMD_REV4(rev + i));
+  }
+
+#undef BLIP_SIMD_LOAD4
+#undef BLIP_SIMD_REV4
+#undef BLIP_SIMD_MADD4
+}
+
+#endif
@@ -45,11 +45,21 @@ class Multi_Buffer {
   [[nodiscard]] int length() const;
   virtual void clock_rate(int /*unused*/);
   virtual void bass_freq(int /*unused*/);
+  virtual void memory_resource(std::pmr::memory_resource* /*unused*/);
+  virtual void exact_ratio(bool /*unused*/ = true);
   virtual void clear();
   virtual void end_frame(blip_time_t /*unused*/);
   virtual int read_samples(blip_sample_t /*unused*/[], int /*unused*/);
   [[nodiscard]] virtual int samples_avail() const;
 
+  // Same as read_samples(), but writes unclamped floating-point samples where 1.0 is
+  // full scale. See Blip_Buffer::read_samples_float().
+  virtual int read_samples_float(float /*unused*/[], int /*unused*/);
+
+  // Reads at most count sample frames into separate left and right channel arrays and
+  // returns number of frames actually read. Mono buffers write the same samples to both.
+  virtual int read_samples_planar(float /*unused*/[], float /*unused*/[], int /*unused*/);
+
  private:
   // noncopyable
   Multi_Buffer(const Multi_Buffer&) = delete;
@@ -101,6 +111,12 @@ class Mono_Buffer : public Multi_Buffer {
   void bass_freq(int freq) override {
     buf.bass_freq(freq);
   }
+  void memory_resource(std::pmr::memory_resource* resource) override {
+    buf.memory_resource(resource);
+  }
+  void exact_ratio(bool enabled = true) override {
+    buf.exact_ratio(enabled);
+  }
   void clear() override {
     buf.clear();
   }
@@ -110,6 +126,10 @@ class Mono_Buffer : public Multi_Buffer {
   int read_samples(blip_sample_t p[], int s) override {
     return buf.read_samples(p, s);
   }
+  int read_samples_float(float p[], int s) override {
+    return buf.read_samples_float(p, s);
+  }
+  int read_samples_planar(float left[], float right[], int count) override;
   channel_t channel(int /*index*/) override {
     return chan;
   }
@@ -134,11 +154,13 @@ class Tracked_Blip_Buffer : public Blip_Buffer {
   // Implementation
 
   int read_samples(blip_sample_t /*out*/[], int /*count*/);
+  int read_samples_float(float /*out*/[], int /*count*/);
   void remove_silence(int /*n*/);
   void remove_samples(int /*n*/);
   Tracked_Blip_Buffer();
   void clear();
   void end_frame(blip_time_t /*t*/);
+  void restore_state(void const* /*in*/, size_t /*size*/);
 
  private:
   int last_non_silence{0};
@@ -158,9 +180,16 @@ class Stereo_Mixer {
   }
   void read_pairs(blip_sample_t out[], int count);
 
+  // Writes left samples to left [0], left [stride], etc. and right samples likewise
+  void read_pairs_float(float left[], float right[], int stride, int count);
+
  private:
   void mix_mono(blip_sample_t out[], int pair_count);
   void mix_stereo(blip_sample_t out[], int pair_count);
+  void mix_mono_float(float left[], float right[], int stride, int pair_count);
+  void mix_stereo_float(float left[], float right[], int stride, int pair_count);
+  void mix_silence(blip_sample_t out[], int pair_count);
+  void mix_silence_float(float left[], float right[], int stride, int pair_count);
 };
 
 // Uses three buffers (one for center) and outputs stereo sample pairs.
@@ -184,6 +213,8 @@ class Stereo_Buffer : public Multi_Buffer {
   std::error_condition set_sample_rate(int /*rate*/, int msec = blip_default_length) override;
   void clock_rate(int /*rate*/) override;
   void bass_freq(int /*bass*/) override;
+  void memory_resource(std::pmr::memory_resource* /*resource*/) override;
+  void exact_ratio(bool enabled = true) override;
   void clear() override;
   channel_t channel(int /*index*/) override {
     return chan;
@@ -193,6 +224,8 @@ class Stereo_Buffer : public Multi_Buffer {
     return (bufs[0].samples_avail() - mixer.samples_read) * 2;
   }
   int read_samples(blip_sample_t /*out*/[], int /*out_size*/) override;
+  int read_samples_float(float /*out*/[], int /*out_size*/) override;
+  int read_samples_planar(float /*left*/[], float /*right*/[], int /*count*/) override;
 
  private:
   enum { bufs_size = 3 };
@@ -201,6 +234,8 @@ class Stereo_Buffer : public Multi_Buffer {
   Stereo_Mixer mixer;
   channel_t chan{};
   int samples_avail_{};
+
+  void remove_mixed_samples();
 };
 
 // Silent_Buffer generates no samples, useful where no sound is wanted
@@ -248,6 +283,10 @@ inline void Multi_Buffer::clock_rate(int /*unused*/) {
 }
 inline void Multi_Buffer::bass_freq(int /*unused*/) {
 }
+inline void Multi_Buffer::memory_resource(std::pmr::memory_resource* /*unused*/) {
+}
+inline void Multi_Buffer::exact_ratio(bool /*unused*/) {
+}
 inline void Multi_Buffer::clear() {
 }
 inline void Multi_Buffer::end_frame(blip_time_t /*unused*/) {
@@ -258,6 +297,12 @@ inline int Multi_Buffer::read_samples(blip_sample_t /*unused*/[], int /*unused*/
 inline int Multi_Buffer::samples_avail() const {
   return 0;
 }
+inline int Multi_Buffer::read_samples_float(float /*unused*/[], int /*unused*/) {
+  return 0;
+}
+inline int Multi_Buffer::read_samples_planar(float /*unused*/[], float /*unused*/[], int /*unused*/) {
+  return 0;
+}
 
 inline std::error_condition Multi_Buffer::set_channel_count(int n, int const types[]) {
   channel_count_ = n;
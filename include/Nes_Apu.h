@@ -3,6 +3,7 @@
 
 #include <climits>
 #include <functional>
+#include <span>
 #include "Nes_Oscs.h"
 
 
@@ -28,6 +29,19 @@ class Nes_Apu {
   enum { io_size = 0x18 };
   void write_register(nes_time_t /*time*/, uint16_t addr, uint8_t data);
 
+  // Register write for write_registers()
+  struct reg_write_t {
+    nes_time_t time;
+    uint16_t addr;
+    uint8_t data;
+  };
+
+  // Same as write_register() for each of count writes, which must be sorted by time, except
+  // that a write to a square, triangle or noise register only runs that oscillator up to
+  // it, rather than all of them. The others are run only up to writes and frame counter
+  // clocks that affect them all.
+  void write_registers(reg_write_t const writes[], int count);
+
   // Reads from status register (0x4015)
   enum { status_addr = 0x4015 };
   uint8_t read_status(nes_time_t /*time*/);
@@ -37,6 +51,14 @@ class Nes_Apu {
   // and each can be whatever length is convenient.
   void end_frame(nes_time_t /*end_time*/);
 
+  // Runs for exactly as many clocks as buf needs to have count samples available, ending
+  // the time frame there and calling end_frame_notifier, then reads count samples from buf
+  // into out. buf must be the output of all oscillators. Returns number of samples read,
+  // which is less than count only if buf is too short to hold count samples. Registers
+  // written before this must use times before the end of the frame, which is not known in
+  // advance, so they're normally written at time 0.
+  int render(Blip_Buffer& buf, blip_sample_t out[], int count);
+
   // Optional
 
   // Resets internal frame counter, registers, and all oscillators.
@@ -53,6 +75,16 @@ class Nes_Apu {
   // Adjusts frame period
   void set_tempo(double /*t*/);
 
+  // Runs to time, then enables or disables fast-forward mode, for seeking, rewinding and
+  // run-ahead. While enabled, nothing is added to the output buffers and only timing,
+  // length counters, envelopes, sweep, frame IRQ and DMC reads and IRQ are kept up to date,
+  // mostly in closed form, which runs hundreds of times faster than real time. Output
+  // resumes when disabled, with a step to each oscillator's current level.
+  void fast_forward(nes_time_t time, bool enabled = true);
+  [[nodiscard]] bool fast_forwarding() const {
+    return fast_forward_;
+  }
+
   // Saves/loads exact emulation state
   void save_state(apu_state_t* out) const;
   void load_state(apu_state_t const&);
@@ -82,6 +114,15 @@ class Nes_Apu {
   // accounted for (i.e. inserting CPU wait states).
   void run_until(nes_time_t /*end_time*/);
 
+  // Makes DMC read samples directly from memory instead of calling dmc_reader. banks [i]
+  // points to the bytes mapped at 0x8000 + i * bank_size, where bank_size is 0x8000 >>
+  // bank_bits. The table is read on every fetch, so bank switches only need to update it.
+  // Pass NULL to go back to dmc_reader.
+  void dmc_memory(uint8_t const* const* banks, int bank_bits);
+
+  // Same, for 32 KB mapped contiguously at 0x8000
+  void dmc_memory(std::span<uint8_t const, 0x8000> rom);
+
   // Implementation
 
   Nes_Apu();
@@ -102,6 +143,11 @@ class Nes_Apu {
   // Use std::bind to add custom parameters.
   std::function<void()> irq_notifier;
 
+  // Called by render() with the end time after this APU's time frame is ended, and before
+  // buf's is. Use it to end the frames of expansion sound chips and any other buffers they
+  // output to.
+  std::function<void(nes_time_t)> end_frame_notifier;
+
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
@@ -123,6 +169,7 @@ class Nes_Apu {
   Nes_Apu& operator=(const Nes_Apu&);
 
   Nes_Osc* oscs[osc_count]{};
+  Blip_Buffer* outputs[osc_count]{};  // restored when fast-forward mode ends
 #ifdef _MSC_VER
   // These are truly private members, and we don't need the compiler
   // to complain "needs to have dll-interface to be used by clients of class"
@@ -147,6 +194,10 @@ class Nes_Apu {
   int frame_mode{};
   bool irq_flag{};
   bool enable_w4011{};
+  bool fast_forward_{};
+  uint8_t const* const* dmc_banks{};  // replaces dmc_reader if not NULL
+  uint8_t const* dmc_rom{};           // table for dmc_memory( rom )
+  int dmc_bank_shift{};
   Nes_Square::Synth square_synth;  // shared by squares
 #ifdef _MSC_VER
 #pragma warning(pop)
@@ -155,11 +206,27 @@ class Nes_Apu {
   void irq_changed();
   void state_restored();
   void run_until_(nes_time_t /*end_time*/);
+  void run_osc(int index, nes_time_t time, nes_time_t end_time);
+  void write_register_(nes_time_t time, uint16_t addr, uint8_t data);
 };
 
 inline void Nes_Apu::set_output(int osc, Blip_Buffer* buf) {
   assert((unsigned)osc < osc_count);
-  oscs[osc]->output = buf;
+  outputs[osc] = buf;
+  if (!fast_forward_) {
+    oscs[osc]->output = buf;
+  }
+}
+
+inline void Nes_Apu::dmc_memory(uint8_t const* const* banks, int bank_bits) {
+  assert((unsigned)bank_bits <= 15);
+  dmc_banks = banks;
+  dmc_bank_shift = 15 - bank_bits;
+}
+
+inline void Nes_Apu::dmc_memory(std::span<uint8_t const, 0x8000> rom) {
+  dmc_rom = rom.data();
+  dmc_memory(&dmc_rom, 0);
 }
 
 inline Nes_Apu::nes_time_t Nes_Apu::earliest_irq(nes_time_t /*unused*/) const {
@@ -1,10 +1,17 @@
 #include "Blip_Buffer.h"
 
+#include <algorithm>
 #include <climits>
 #include <cmath>
 #include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
 #include <numeric>
 #include <numbers>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
 
 
 /* Copyright (C) 2003-2008 Shay Green. This module is free software; you
@@ -20,11 +27,24 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
 
 //// Blip_Buffer
 
-Blip_Buffer::Blip_Buffer() : Blip_Buffer_() {
+template <class Config>
+Basic_Blip_Buffer<Config>::Basic_Blip_Buffer() : Basic_Blip_Buffer(std::pmr::get_default_resource()) {
+}
+
+template <class Config>
+Basic_Blip_Buffer<Config>::Basic_Blip_Buffer(std::pmr::memory_resource* resource) {
+  resource_ = resource;
   factor_ = std::numeric_limits<uint32_t>::max() / 2 + 1;
   buffer_ = nullptr;
   buffer_center_ = nullptr;
   buffer_size_ = 0;
+  storage_ = nullptr;
+  storage_size_ = 0;
+  ring_mode_ = false;
+  exact_ratio_ = false;
+  ratio_error_ = 0;
+  ratio_rem_ = 0;
+  tap_ = nullptr;
   sample_rate_ = 0;
   bass_shift_ = 0;
   clock_rate_ = 0;
@@ -45,47 +65,74 @@ Blip_Buffer::Blip_Buffer() : Blip_Buffer_() {
   clear();
 }
 
-Blip_Buffer::~Blip_Buffer() {
-  free(buffer_);
+template <class Config>
+Basic_Blip_Buffer<Config>::~Basic_Blip_Buffer() {
+  free_storage();
+}
+
+template <class Config>
+void Basic_Blip_Buffer<Config>::free_storage() {
+  if (storage_ != nullptr) {
+    resource_->deallocate(storage_, storage_size_ * Config::channels * sizeof *storage_, blip_buffer_alignment);
+    storage_ = nullptr;
+    storage_size_ = 0;
+  }
 }
 
-void Blip_Buffer::clear() {
-  bool const entire_buffer = true;
+template <class Config>
+void Basic_Blip_Buffer<Config>::memory_resource(std::pmr::memory_resource* resource) {
+  assert(storage_ == nullptr);  // must be set before anything is allocated
+  resource_ = resource;
+}
 
+template <class Config>
+void Basic_Blip_Buffer<Config>::clear() {
   offset_ = 0;
-  reader_accum_ = 0;
+  ratio_rem_ = 0;
+  std::fill_n(reader_accum_, Config::channels, 0);
   modified_ = false;
 
-  if (buffer_ != nullptr) {
-    int count = (entire_buffer ? buffer_size_ : samples_avail());
-    memset(buffer_, 0, (count + blip_buffer_extra_) * sizeof(delta_t));
+  if (storage_ != nullptr) {
+    buffer_ = storage_;
+    buffer_center_ = buffer_ + Config::max_quality / 2 * Config::channels;
+    memset(storage_, 0, storage_size_ * Config::channels * sizeof(delta_t));
   }
 }
 
-std::error_condition Blip_Buffer::set_sample_rate(int new_rate, int msec) {
-  // Limit to maximum size that resampled time can represent
-  int max_size =
-      (((blip_resampled_time_t)-1) >> BLIP_BUFFER_ACCURACY) - blip_buffer_extra_ - 64;  // TODO: -64 isn't needed
-  int new_size = (new_rate * (msec + 1) + 999) / 1000;
+template <class Config>
+std::error_condition Basic_Blip_Buffer<Config>::set_sample_rate(int new_rate, int msec) {
+  // Limit to maximum size that resampled time can represent, and that leaves room for
+  // ring mode's second window in an int
+  long long max_size = std::min<long long>(((fixed_t)-1) >> Config::accuracy, INT_MAX / 2) -
+                       Config::buffer_extra - 64;  // TODO: -64 isn't needed
+  long long new_size = ((long long)new_rate * (msec + 1) + 999) / 1000;
   if (new_size > max_size) {
     new_size = max_size;
   }
 
+  // Ring mode keeps a second buffer length of room to slide the window into
+  int new_storage_size = (int)new_size + Config::buffer_extra;
+  if (ring_mode_) {
+    new_storage_size += new_size;
+  }
+
   // Resize buffer
-  if (buffer_size_ != new_size) {
-    // dprintf( "%d \n", (new_size + blip_buffer_extra_) * sizeof *buffer_  );
-    void* p = realloc(buffer_, (new_size + blip_buffer_extra_) * sizeof *buffer_);
-    if (p == nullptr) {
+  if (storage_size_ != new_storage_size) {
+    void* p;
+    try {
+      p = resource_->allocate(new_storage_size * Config::channels * sizeof *storage_, blip_buffer_alignment);
+    } catch (std::bad_alloc const&) {
       return std::make_error_condition(std::errc::not_enough_memory);
     }
-    buffer_ = (delta_t*)p;
-    buffer_center_ = buffer_ + BLIP_MAX_QUALITY / 2;
-    buffer_size_ = new_size;
+    free_storage();  // contents don't need preserving since buffer is cleared below
+    storage_ = (delta_t*)p;
+    storage_size_ = new_storage_size;
   }
+  buffer_size_ = (int)new_size;
 
   // Update sample_rate and things that depend on it
   sample_rate_ = new_rate;
-  length_ = new_size * 1000 / new_rate - 1;
+  length_ = (int)(new_size * 1000 / new_rate - 1);
   if (clock_rate_ != 0) {
     clock_rate(clock_rate_);
   }
@@ -96,14 +143,57 @@ std::error_condition Blip_Buffer::set_sample_rate(int new_rate, int msec) {
   return {};
 }
 
-blip_resampled_time_t Blip_Buffer::clock_rate_factor(int rate) const {
+template <class Config>
+typename Basic_Blip_Buffer<Config>::fixed_t Basic_Blip_Buffer<Config>::clock_rate_factor(int rate) const {
   double ratio = (double)sample_rate_ / rate;
-  int factor = (int)floor(ratio * (1 << BLIP_BUFFER_ACCURACY) + 0.5);
+  auto factor = (fixed_t)floor(ratio * ((fixed_t)1 << Config::accuracy) + 0.5);
   assert(factor > 0 || !sample_rate_);  // fails if clock/output ratio is too large
-  return (blip_resampled_time_t)factor;
+  return factor;
 }
 
-void Blip_Buffer::bass_freq(int freq) {
+template <class Config>
+void Basic_Blip_Buffer<Config>::clock_rate(int cps) {
+  factor_ = clock_rate_factor(clock_rate_ = cps);
+
+  // Error is at most half a unit of factor_, so it fits easily
+  ratio_error_ = 0;
+  if (exact_ratio_ && cps != 0) {
+    long long const exact = ((long long)sample_rate_ << Config::accuracy) - (long long)factor_ * cps;
+    ratio_error_ = (int)exact;
+  }
+}
+
+template <class Config>
+void Basic_Blip_Buffer<Config>::exact_ratio(bool enabled) {
+  exact_ratio_ = enabled;
+  ratio_rem_ = 0;
+  if (clock_rate_ != 0) {
+    clock_rate(clock_rate_);
+  }
+}
+
+template <class Config>
+typename Basic_Blip_Buffer<Config>::fixed_t Basic_Blip_Buffer<Config>::frame_duration(clocks_t t, int* rem_out) const {
+  fixed_t duration = t * factor_;
+  int rem = ratio_rem_;
+  if (ratio_error_ != 0) {
+    // Floor division, as error can be negative
+    long long const error = ratio_rem_ + (long long)t * ratio_error_;
+    long long whole = error / clock_rate_;
+    if (error % clock_rate_ < 0) {
+      whole--;
+    }
+    duration += (fixed_t)whole;
+    rem = (int)(error - whole * clock_rate_);
+  }
+  if (rem_out != nullptr) {
+    *rem_out = rem;
+  }
+  return duration;
+}
+
+template <class Config>
+void Basic_Blip_Buffer<Config>::bass_freq(int freq) {
   bass_freq_ = freq;
   int shift = 31;
   if (freq > 0 && (sample_rate_ != 0)) {
@@ -115,37 +205,84 @@ void Blip_Buffer::bass_freq(int freq) {
   bass_shift_ = shift;
 }
 
-void Blip_Buffer::end_frame(blip_time_t t) {
-  offset_ += t * factor_;
+template <class Config>
+void Basic_Blip_Buffer<Config>::end_frame(blip_time_t t) {
+  offset_ += frame_duration(t, &ratio_rem_);
   assert(samples_avail() <= (int)buffer_size_);  // fails if time is past end of buffer
+  if (tap_ != nullptr) {
+    tap_->end_frame(t);
+  }
+}
+
+template <class Config>
+void Basic_Blip_Buffer<Config>::add_tap(Buffer* tap) {
+  assert(tap != this && tap->tap_ == nullptr);
+  Basic_Blip_Buffer* last = this;
+  while (last->tap_ != nullptr) {
+    last = last->tap_;
+  }
+  last->tap_ = tap;
 }
 
-int Blip_Buffer::count_samples(blip_time_t t) const {
-  blip_resampled_time_t last_sample = resampled_time(t) >> BLIP_BUFFER_ACCURACY;
-  blip_resampled_time_t first_sample = offset_ >> BLIP_BUFFER_ACCURACY;
+template <class Config>
+int Basic_Blip_Buffer<Config>::count_samples(blip_time_t t) const {
+  fixed_t last_sample = (frame_duration(t) + offset_) >> Config::accuracy;
+  fixed_t first_sample = offset_ >> Config::accuracy;
   return (int)(last_sample - first_sample);
 }
 
-blip_time_t Blip_Buffer::count_clocks(int count) const {
+template <class Config>
+blip_time_t Basic_Blip_Buffer<Config>::count_clocks(int count) const {
   if (count > buffer_size_) {
     count = buffer_size_;
   }
-  blip_resampled_time_t time = (blip_resampled_time_t)count << BLIP_BUFFER_ACCURACY;
-  return (blip_time_t)((time - offset_ + factor_ - 1) / factor_);
+  fixed_t time = (fixed_t)count << Config::accuracy;
+  auto clocks = (blip_time_t)((time - offset_ + factor_ - 1) / factor_);
+
+  // Carried error can shift result by a few clocks either way
+  if (ratio_error_ != 0) {
+    while (clocks > 0 && frame_duration(clocks - 1) >= time - offset_) {
+      clocks--;
+    }
+    while (frame_duration(clocks) < time - offset_) {
+      clocks++;
+    }
+  }
+  return clocks;
 }
 
-void Blip_Buffer::remove_samples(int count) {
+template <class Config>
+void Basic_Blip_Buffer<Config>::remove_samples(int count) {
   if (count != 0) {
     remove_silence(count);
 
+    int const channels = Config::channels;
+    int remain = (samples_avail() + Config::buffer_extra) * channels;
+    count *= channels;
+    if (ring_mode_) {
+      // Everything in storage past the window is kept cleared, so the window can simply
+      // slide forward until it reaches the end of storage
+      delta_t* window = buffer_ + count;
+      if (window + (buffer_size_ + Config::buffer_extra) * channels > storage_ + storage_size_ * channels) {
+        // wrap around by copying remaining samples back to the start, then clearing
+        // everything that was used since the last wrap
+        memmove(storage_, window, remain * sizeof *buffer_);
+        memset(storage_ + remain, 0, (window - storage_) * sizeof *buffer_);
+        window = storage_;
+      }
+      buffer_ = window;
+      buffer_center_ = buffer_ + Config::max_quality / 2 * channels;
+      return;
+    }
+
     // copy remaining samples to beginning and clear old samples
-    int remain = samples_avail() + blip_buffer_extra_;
     memmove(buffer_, buffer_ + count, remain * sizeof *buffer_);
     memset(buffer_ + remain, 0, count * sizeof *buffer_);
   }
 }
 
-int Blip_Buffer::read_samples(blip_sample_t out_[], int max_samples, bool stereo) {
+template <class Config>
+int Basic_Blip_Buffer<Config>::read_samples(blip_sample_t out_[], int max_samples, bool stereo) {
   int count = samples_avail();
   if (count > max_samples) {
     count = max_samples;
@@ -153,6 +290,37 @@ int Blip_Buffer::read_samples(blip_sample_t out_[], int max_samples, bool stereo
 
   if (count != 0) {
     int const bass = highpass_shift();
+
+    if constexpr (Config::channels == 2) {
+      // Both channels are integrated in one pass, writing interleaved pairs
+      assert(!stereo);  // output is already stereo
+      delta_t const* reader = read_pos() + count * 2;
+      int left_sum = integrator(0);
+      int right_sum = integrator(1);
+
+      blip_sample_t* __restrict out = out_ + count * 2;
+      int offset = -count * 2;
+      do {
+        int l = left_sum >> delta_bits;
+        int r = right_sum >> delta_bits;
+
+        left_sum -= left_sum >> bass;
+        right_sum -= right_sum >> bass;
+        left_sum += reader[offset];
+        right_sum += reader[offset + 1];
+
+        BLIP_CLAMP(l, l);
+        BLIP_CLAMP(r, r);
+        out[offset] = (blip_sample_t)l;
+        out[offset + 1] = (blip_sample_t)r;
+      } while ((offset += 2) != 0);
+
+      set_integrator(left_sum, 0);
+      set_integrator(right_sum, 1);
+      remove_samples(count);
+      return count;
+    }
+
     delta_t const* reader = read_pos() + count;
     int reader_sum = integrator();
 
@@ -167,7 +335,7 @@ int Blip_Buffer::read_samples(blip_sample_t out_[], int max_samples, bool stereo
         int s = reader_sum >> delta_bits;
 
         reader_sum -= reader_sum >> bass;
-        reader_sum += reader[offset];
+        reader_sum += reader[offset] << Config::delta_shift;
 
         BLIP_CLAMP(s, s);
         out[offset] = (blip_sample_t)s;
@@ -178,7 +346,7 @@ int Blip_Buffer::read_samples(blip_sample_t out_[], int max_samples, bool stereo
         int s = reader_sum >> delta_bits;
 
         reader_sum -= reader_sum >> bass;
-        reader_sum += reader[offset];
+        reader_sum += reader[offset] << Config::delta_shift;
 
         BLIP_CLAMP(s, s);
         out[offset * 2] = (blip_sample_t)s;
@@ -192,63 +360,356 @@ int Blip_Buffer::read_samples(blip_sample_t out_[], int max_samples, bool stereo
   return count;
 }
 
-void Blip_Buffer::mix_samples(blip_sample_t const in[], int count) {
-  delta_t* out = buffer_center_ + (offset_ >> BLIP_BUFFER_ACCURACY);
+template <class Config>
+void Basic_Blip_Buffer<Config>::read_samples(Buffer* const bufs[], blip_sample_t* const out[], int count, int n) {
+  int i = 0;
+  if constexpr (Config::channels == 1 && Config::delta_shift == 0) {
+    for (; i + blip_lane_count <= count; i += blip_lane_count) {
+      Buffer* const* lane = &bufs[i];
+
+      int const bass = lane[0]->highpass_shift();
+      bool same_bass = true;
+      delta_t const* in[blip_lane_count];
+      int sums[blip_lane_count];
+      for (int j = 0; j < blip_lane_count; j++) {
+        assert(n <= lane[j]->samples_avail());
+        same_bass &= (lane[j]->highpass_shift() == bass);
+        in[j] = lane[j]->read_pos();
+        sums[j] = lane[j]->integrator();
+      }
+
+      if (!same_bass) {
+        break;
+      }
+
+      if (n != 0) {
+        blip_integrate_lanes(in, &out[i], sums, bass, n);
+      }
 
-  int const sample_shift = blip_sample_bits - 16;
+      for (int j = 0; j < blip_lane_count; j++) {
+        lane[j]->set_integrator(sums[j]);
+        lane[j]->remove_samples(n);
+      }
+    }
+  }
+
+  // remaining buffers, and stereo and compact buffers, which can't be run as lanes
+  for (; i < count; i++) {
+    bufs[i]->read_samples(out[i], n);
+  }
+}
+
+template <class Config>
+int Basic_Blip_Buffer<Config>::read_samples_float(float out_[], int max_samples, bool stereo) {
+  int count = samples_avail();
+  if (count > max_samples) {
+    count = max_samples;
+  }
+
+  if (count != 0) {
+    int const bass = highpass_shift();
+
+    if constexpr (Config::channels == 2) {
+      assert(!stereo);  // output is already stereo
+      delta_t const* reader = read_pos() + count * 2;
+      int left_sum = integrator(0);
+      int right_sum = integrator(1);
+
+      float* __restrict out = out_ + count * 2;
+      int offset = -count * 2;
+      do {
+        out[offset] = (float)left_sum * blip_sample_float_scale;
+        out[offset + 1] = (float)right_sum * blip_sample_float_scale;
+
+        left_sum -= left_sum >> bass;
+        right_sum -= right_sum >> bass;
+        left_sum += reader[offset];
+        right_sum += reader[offset + 1];
+      } while ((offset += 2) != 0);
+
+      set_integrator(left_sum, 0);
+      set_integrator(right_sum, 1);
+      remove_samples(count);
+      return count;
+    }
+
+    int const step = (stereo ? 2 : 1);
+    delta_t const* reader = read_pos() + count;
+    int reader_sum = integrator();
+
+    float* __restrict out = out_ + count * step;
+    int offset = -count;
+    do {
+      out[offset * step] = (float)reader_sum * blip_sample_float_scale;
+
+      reader_sum -= reader_sum >> bass;
+      reader_sum += reader[offset] << Config::delta_shift;
+    } while (++offset != 0);
+
+    set_integrator(reader_sum);
+
+    remove_samples(count);
+  }
+  return count;
+}
+
+template <class Config>
+void Basic_Blip_Buffer<Config>::mix_samples(blip_sample_t const in[], int count) {
+  int const channels = Config::channels;
+  delta_t* out = buffer_center_ + (offset_ >> Config::accuracy) * channels;
+
+  // Stereo buffers get the same samples in both channels
+  int const sample_shift = blip_sample_bits - 16 - Config::delta_shift;
   int prev = 0;
   while (--count >= 0) {
     int s = *in++ << sample_shift;
-    *out += s - prev;
+    for (int c = 0; c < channels; c++) {
+      out[c] = blip_add_delta(out[c], s - prev);
+    }
     prev = s;
-    ++out;
+    out += channels;
+  }
+  for (int c = 0; c < channels; c++) {
+    out[c] = blip_add_delta(out[c], -prev);
   }
-  *out -= prev;
 }
 
-void Blip_Buffer::save_state(blip_buffer_state_t* out) {
+// Simple loops so the compiler can vectorize them
+template <class T>
+static void add_deltas(T* __restrict out, T const* __restrict in, int count) {
+  for (int i = 0; i < count; i++) {
+    out[i] = blip_add_delta(out[i], in[i]);
+  }
+}
+
+// Gain is 16.16 fixed-point. Products are rounded to nearest.
+template <class T>
+static void add_deltas(T* __restrict out, T const* __restrict in, int gain, int count) {
+  for (int i = 0; i < count; i++) {
+    out[i] = blip_add_delta(out[i], (int)(((long long)in[i] * gain + 0x8000) >> 16));
+  }
+}
+
+template <class Config>
+void Basic_Blip_Buffer<Config>::mix_buffers(Buffer* const srcs[], double const gains[], int count) {
+  for (int i = 0; i < count; i++) {
+    Basic_Blip_Buffer& src = *srcs[i];
+    assert(&src != this);
+    assert(src.sample_rate_ == sample_rate_ && src.factor_ == factor_);
+
+    int const n = src.samples_avail();
+    assert(n <= samples_avail());  // fails if source was ended later than this buffer
+    if (n == 0) {
+      continue;
+    }
+
+    if (gains == nullptr || gains[i] == 1.0) {
+      add_deltas(read_pos(), src.read_pos(), n * Config::channels);
+    } else {
+      assert(-32768.0 < gains[i] && gains[i] < 32768.0);
+      add_deltas(read_pos(), src.read_pos(), (int)floor(gains[i] * 65536 + 0.5), n * Config::channels);
+    }
+
+    if (src.modified()) {
+      src.clear_modified();
+      set_modified();
+    }
+    src.remove_samples(n);
+  }
+}
+
+template <class Config>
+void Basic_Blip_Buffer<Config>::save_state(basic_blip_buffer_state_t<Config>* out) {
   assert(samples_avail() == 0);
   out->offset_ = offset_;
-  out->reader_accum_ = reader_accum_;
-  memcpy(out->buf, &buffer_[offset_ >> BLIP_BUFFER_ACCURACY], sizeof out->buf);
+  out->ratio_rem_ = ratio_rem_;
+  std::copy_n(reader_accum_, Config::channels, out->reader_accum_);
+  memcpy(out->buf, &buffer_[(offset_ >> Config::accuracy) * Config::channels], sizeof out->buf);
 }
 
-void Blip_Buffer::load_state(blip_buffer_state_t const& in) {
+template <class Config>
+void Basic_Blip_Buffer<Config>::load_state(basic_blip_buffer_state_t<Config> const& in) {
   clear();
 
   offset_ = in.offset_;
-  reader_accum_ = in.reader_accum_;
+  ratio_rem_ = in.ratio_rem_;
+  std::copy_n(in.reader_accum_, Config::channels, reader_accum_);
   memcpy(buffer_, in.buf, sizeof in.buf);
 }
 
-//// Blip_Synth_
+// Followed by the deltas of unread samples and the tails after them
+template <class Config>
+struct blip_capture_header_t {
+  typename Config::resampled_time_t offset;
+  int ratio_rem;
+  int reader_accum[Config::channels];
+  int delta_count;
+  bool modified;
+};
+
+template <class Config>
+size_t Basic_Blip_Buffer<Config>::capture_size() const {
+  int const delta_count = (samples_avail() + Config::buffer_extra) * Config::channels;
+  return sizeof(blip_capture_header_t<Config>) + delta_count * sizeof(delta_t);
+}
 
-Blip_Synth_Fast_::Blip_Synth_Fast_() {
+template <class Config>
+size_t Basic_Blip_Buffer<Config>::capture_state(void* out) {
+  blip_capture_header_t<Config> header{};
+  header.offset = offset_;
+  header.ratio_rem = ratio_rem_;
+  std::copy_n(reader_accum_, Config::channels, header.reader_accum);
+  header.delta_count = (samples_avail() + Config::buffer_extra) * Config::channels;
+  header.modified = modified_;
+
+  memcpy(out, &header, sizeof header);
+  memcpy((char*)out + sizeof header, buffer_, header.delta_count * sizeof(delta_t));
+  return sizeof header + header.delta_count * sizeof(delta_t);
 }
 
+template <class Config>
+void Basic_Blip_Buffer<Config>::restore_state(void const* in, size_t size) {
+  blip_capture_header_t<Config> header;
+  assert(size >= sizeof header);
+  memcpy(&header, in, sizeof header);
+  assert(size == sizeof header + header.delta_count * sizeof(delta_t));
+  (void)size;
+
+  clear();
+  offset_ = header.offset;
+  assert(samples_avail() <= buffer_size_);  // fails if state is from a longer buffer
+  ratio_rem_ = header.ratio_rem;
+  std::copy_n(header.reader_accum, Config::channels, reader_accum_);
+  modified_ = header.modified;
+  memcpy(buffer_, (char const*)in + sizeof header, header.delta_count * sizeof(delta_t));
+}
+
+template class Basic_Blip_Buffer<blip_default_config>;
+template class Basic_Blip_Buffer<blip_stereo_config>;
+template class Basic_Blip_Buffer<blip_compact_config>;
+#if !BLIP_BUFFER_FAST
+template class Basic_Blip_Buffer<blip_fast_config>;
+#endif
+
+//// Blip_Synth_
+
 void Blip_Synth_Fast_::volume_unit(double new_unit) {
   delta_factor = int(new_unit * (1 << blip_sample_bits) + 0.5);
 }
 
-#if BLIP_BUFFER_FAST
+// Used until treble_eq() or volume() is first called
+static short const blip_no_kernel[32 / 2 * 64] = {};
+
+Blip_Synth_::Blip_Synth_(int w, int r)
+    : delta_factor(0),
+      last_amp(0),
+      phases(blip_no_kernel),
+      volume_unit_(0.0),
+      key_(),
+      cached_(false),
+      width(w),
+      res(r),
+      kernel_unit(0) {
+  if (impulses_size() > (int)(sizeof blip_no_kernel / sizeof *blip_no_kernel)) {
+    kernel_.reset(new short[impulses_size()]());
+    phases = kernel_.get();
+  }
+}
+
+#undef PI
+#define PI 3.1415926535897932384626433832795029
+
+// Math functions that can also be evaluated at compile time, for default kernels. At run
+// time they're the standard library ones.
 
-void blip_eq_t::generate(float* out, int count) const {
+static constexpr double blip_floor(double x) {
+  if (!std::is_constant_evaluated()) {
+    return floor(x);
+  }
+  double const i = (double)(long long)x;
+  return i > x ? i - 1.0 : i;
+}
+
+// ln(2) split so that k * ln2_hi is exact for small k
+static constexpr double blip_ln2_hi = 6.93147180369123816490e-01;
+static constexpr double blip_ln2_lo = 1.90821492927058770002e-10;
+
+static constexpr double blip_exp(double x) {
+  // exp(x) = 2^k * exp(r), |r| <= ln(2)/2
+  int const k = (int)blip_floor(x / (blip_ln2_hi + blip_ln2_lo) + 0.5);
+  double const r = (x - k * blip_ln2_hi) - k * blip_ln2_lo;
+  double sum = 1.0;
+  double term = 1.0;
+  for (int n = 1; sum + term != sum; n++) {
+    term *= r / n;
+    sum += term;
+  }
+  for (int i = k; i > 0; i--) {
+    sum *= 2.0;
+  }
+  for (int i = k; i < 0; i++) {
+    sum *= 0.5;
+  }
+  return sum;
 }
 
-#else
+static constexpr double blip_log(double x) {
+  // log(x) = k * ln(2) + log(m), sqrt(1/2) <= m < sqrt(2)
+  double const sqrt2 = 1.41421356237309504880;
+  int k = 0;
+  for (; x >= sqrt2; x *= 0.5) {
+    k++;
+  }
+  for (; x < sqrt2 / 2; x *= 2.0) {
+    k--;
+  }
 
-Blip_Synth_::Blip_Synth_(short p[], int w)
-    : volume_unit_(0.0), buf(nullptr), last_amp(0), delta_factor(0), phases(p), width(w), kernel_unit(0) {
+  // log(m) = 2 * atanh(s), s = (m - 1) / (m + 1)
+  double const s = (x - 1.0) / (x + 1.0);
+  double const s2 = s * s;
+  double sum = 0.0;
+  double term = s;
+  for (int n = 1; sum + term / n != sum; n += 2) {
+    sum += term / n;
+    term *= s2;
+  }
+  return k * blip_ln2_hi + (sum * 2.0 + k * blip_ln2_lo);
 }
 
-#undef PI
-#define PI 3.1415926535897932384626433832795029
+static constexpr double blip_pow(double x, double y) {
+  if (!std::is_constant_evaluated()) {
+    return pow(x, y);
+  }
+  return blip_exp(y * blip_log(x));
+}
+
+static constexpr double blip_cos(double x) {
+  if (!std::is_constant_evaluated()) {
+    return cos(x);
+  }
+
+  // Reduce to |r| <= pi/4 using pi/2 split so that n * pio2_hi is exact for small n
+  double const pio2_hi = 1.57079632673412561417e+00;
+  double const pio2_lo = 6.07710050650619224932e-11;
+  int const n = (int)blip_floor(x / (pio2_hi + pio2_lo) + 0.5);
+  double const r = (x - n * pio2_hi) - n * pio2_lo;
+  double const r2 = r * r;
+
+  // cos(r) for even quadrants, sin(r) for odd ones
+  double sum = (n & 1) ? r : 1.0;
+  double term = sum;
+  for (int i = (n & 1) ? 2 : 1; sum + term != sum; i += 2) {
+    term *= -r2 / (i * (i + 1));
+    sum += term;
+  }
+  return ((n + 1) & 2) ? -sum : sum;
+}
 
 // Generates right half of sinc kernel (including center point) with cutoff at
 // sample rate / 2 / oversample. Frequency response at cutoff frequency is
 // treble dB (-6=0.5,-12=0.25). Mid controls frequency that rolloff begins at,
 // cut * sample rate / 2.
-static void gen_sinc(float out[], int out_size, double oversample, double treble, double mid) {
+static constexpr void gen_sinc(float out[], int out_size, double oversample, double treble, double mid) {
   if (mid > 0.9999) {
     mid = 0.9999;
   }
@@ -260,15 +721,15 @@ static void gen_sinc(float out[], int out_size, double oversample, double treble
   }
 
   double const maxh = 4096.0;
-  double rolloff = pow(10.0, 1.0 / (maxh * 20.0) * treble / (1.0 - mid));
-  double const pow_a_n = pow(rolloff, maxh - maxh * mid);
+  double rolloff = blip_pow(10.0, 1.0 / (maxh * 20.0) * treble / (1.0 - mid));
+  double const pow_a_n = blip_pow(rolloff, maxh - maxh * mid);
   double const to_angle = std::numbers::pi / maxh / oversample;
   for (int i = 1; i < out_size; i++) {
     double angle = i * to_angle;
-    double c = rolloff * cos(angle * maxh - angle) - cos(angle * maxh);
-    double cos_nc_angle = cos(angle * maxh * mid);
-    double cos_nc1_angle = cos(angle * maxh * mid - angle);
-    double cos_angle = cos(angle);
+    double c = rolloff * blip_cos(angle * maxh - angle) - blip_cos(angle * maxh);
+    double cos_nc_angle = blip_cos(angle * maxh * mid);
+    double cos_nc1_angle = blip_cos(angle * maxh * mid - angle);
+    double cos_angle = blip_cos(angle);
 
     c = c * pow_a_n - rolloff * cos_nc1_angle + cos_nc_angle;
     double d = 1.0 + rolloff * (rolloff - cos_angle - cos_angle);
@@ -284,8 +745,8 @@ static void gen_sinc(float out[], int out_size, double oversample, double treble
 }
 
 // Gain is 1-2800 for beta of 0-10, instead of 1.0 as it should be, but
-// this is corrected by normalization in treble_eq().
-static void kaiser_window(float io[], int count, float beta) {
+// this is corrected by normalization in gen_kernel().
+static constexpr void kaiser_window(float io[], int count, float beta) {
   int const accuracy = 10;
 
   float const beta2 = beta * beta;
@@ -309,10 +770,17 @@ static void kaiser_window(float io[], int count, float beta) {
   }
 }
 
-void blip_eq_t::generate(float out[], int count) const {
+static constexpr void gen_eq(float out[],
+                             int count,
+                             int oversample,
+                             double treble,
+                             int rolloff_freq,
+                             int sample_rate,
+                             int cutoff_freq,
+                             double kaiser) {
   // lower cutoff freq for narrow kernels with their wider transition band
   // (8 points->1.49, 16 points->1.15)
-  double cutoff_adj = blip_res * 2.25 / count + 0.85;
+  double cutoff_adj = oversample * 2.25 / count + 0.85;
   if (cutoff_adj < 1.02) {
     cutoff_adj = 1.02;
   }
@@ -324,15 +792,66 @@ void blip_eq_t::generate(float out[], int count) const {
 
   gen_sinc(out, count, oversample * cutoff_adj, treble, cutoff);
 
-  kaiser_window(out, count, kaiser);
+  kaiser_window(out, count, (float)kaiser);
 }
 
-void Blip_Synth_::treble_eq(blip_eq_t const& eq) {
-  // Generate right half of kernel
-  int const half_size = blip_eq_t::calc_count(width);
-  float fimpulse[blip_res / 2 * (BLIP_MAX_QUALITY - 1) + 1];
-  eq.generate(fimpulse, half_size);
+void blip_eq_t::generate(float out[], int count) const {
+  gen_eq(out, count, oversample, treble, rolloff_freq, sample_rate, cutoff_freq, kaiser);
+}
+
+static constexpr void adjust_impulse(short phases[], int width, int res, int kernel_unit) {
+  int const size = res / 2 * width;
+  int const half_width = width / 2;
+
+  // Sum each phase as would be done when synthesizing, and correct
+  // any that don't add up to exactly kernel_half.
+  for (int phase = res / 2; --phase >= 0;) {
+    int const fwd = phase * half_width;
+    int const rev = size - half_width - fwd;
+
+    int error = kernel_unit;
+    for (int i = half_width; --i >= 0;) {
+      error += phases[fwd + i];
+      error += phases[rev + i];
+    }
+    phases[fwd + half_width - 1] -= (short)error;
+
+    // Error shouldn't occur now with improved calculation
+    // if ( error ) printf( "error: %ld\n", error );
+  }
+
+#if 0
+		for ( int i = 0; i < res; i++, printf( "\n" ) )
+			for ( int j = 0; j < width / 2; j++ )
+				printf( "%5d,", (int) -phases [j + width/2 * i] );
+#endif
+}
+
+static void rescale_kernel(short phases[], int width, int res, int shift, int kernel_unit) {
+  // Keep values positive to avoid round-towards-zero of sign-preserving
+  // right shift for negative values.
+  int const keep_positive = 0x8000 + (1 << (shift - 1));
+
+  int const half_width = width / 2;
+  for (int phase = res; --phase >= 0;) {
+    int const fwd = phase * half_width;
+
+    // Integrate, rescale, then differentiate again.
+    // If differences are rescaled directly, more error results.
+    int sum = keep_positive;
+    for (int i = 0; i < half_width; i++) {
+      int prev = sum;
+      sum += phases[fwd + i];
+      phases[fwd + i] = (sum >> shift) - (prev >> shift);
+    }
+  }
 
+  adjust_impulse(phases, width, res, kernel_unit);
+}
+
+// Converts right half of impulse response into interleaved phases and returns kernel unit
+static constexpr int gen_kernel(float const fimpulse[], int width, int res, short phases[]) {
+  int const half_size = blip_eq_t::calc_count(width, res);
   int i = 0;
 
   // Find rescale factor. Summing from small to large (right to left)
@@ -347,97 +866,158 @@ void Blip_Synth_::treble_eq(blip_eq_t const& eq) {
   // double const base_unit = 37888.0; // allows treble to +5 dB
   double const base_unit = 32768.0;  // necessary for blip_unscaled to work
   double rescale = base_unit / total;
-  kernel_unit = (int)base_unit;
+  int const kernel_unit = (int)base_unit;
 
   // Integrate, first difference, rescale, convert to int
   double sum = 0;
   double next = 0;
-  int const size = impulses_size();
+  int const size = res / 2 * width;
   for (i = 0; i < size; i++) {
     int j = (half_size - 1) - i;
 
-    if (i >= blip_res) {
-      sum += fimpulse[j + blip_res];
+    if (i >= res) {
+      sum += fimpulse[j + res];
     }
 
     // goes slightly past center, so it needs a little mirroring
     next += fimpulse[j < 0 ? -j : j];
 
     // calculate unintereleved index
-    int x = (~i & (blip_res - 1)) * (width >> 1) + (i >> BLIP_PHASE_BITS);
+    int x = (~i & (res - 1)) * (width >> 1) + i / res;
     assert((unsigned)x < (unsigned)size);
 
     // flooring separately virtually eliminates error
-    phases[x] = (short)(int)(floor(sum * rescale + 0.5) - floor(next * rescale + 0.5));
+    phases[x] = (short)(int)(blip_floor(sum * rescale + 0.5) - blip_floor(next * rescale + 0.5));
     // phases [x] = (short) (int)
     //       floor( sum * rescale - next * rescale + 0.5 );
   }
 
-  adjust_impulse();
+  adjust_impulse(phases, width, res, kernel_unit);
+  return kernel_unit;
+}
 
-  // volume might require rescaling
-  double vol = volume_unit_;
-  if (vol != 0.0) {
-    volume_unit_ = 0.0;
-    volume_unit(vol);
+// Kernels for blip_eq_t(blip_default_treble), generated at compile time
+
+static constexpr double blip_default_treble = -8.0;
+
+template <int width>
+struct blip_kernel_table_t {
+  short phases[blip_res / 2 * width];
+  int unit;
+};
+
+template <int width>
+static consteval blip_kernel_table_t<width> default_kernel() {
+  float fimpulse[blip_res / 2 * (width - 1) + 1]{};
+  // same parameters as blip_eq_t(blip_default_treble)
+  gen_eq(fimpulse, blip_eq_t::calc_count(width), blip_res, blip_default_treble, 0, 44100, 0, 5.2);
+  blip_kernel_table_t<width> kernel{};
+  kernel.unit = gen_kernel(fimpulse, width, blip_res, kernel.phases);
+  return kernel;
+}
+
+static constexpr blip_kernel_table_t<8> blip_default_kernel_8 = default_kernel<8>();
+static constexpr blip_kernel_table_t<12> blip_default_kernel_12 = default_kernel<12>();
+static constexpr blip_kernel_table_t<16> blip_default_kernel_16 = default_kernel<16>();
+
+// Sets phases and unit to default kernel for width, if there is one
+static bool default_kernel(int width, short const*& phases, int& unit) {
+  switch (width) {
+    case 8:
+      phases = blip_default_kernel_8.phases;
+      unit = blip_default_kernel_8.unit;
+      return true;
+    case 12:
+      phases = blip_default_kernel_12.phases;
+      unit = blip_default_kernel_12.unit;
+      return true;
+    case 16:
+      phases = blip_default_kernel_16.phases;
+      unit = blip_default_kernel_16.unit;
+      return true;
+    default:
+      return false;
   }
 }
 
-void Blip_Synth_::adjust_impulse() {
-  int const size = impulses_size();
-  int const half_width = width / 2;
+void Blip_Synth_::use_cached_kernel(kernel_key_t const& key) {
+  key_ = key;
 
-  // Sum each phase as would be done when synthesizing, and correct
-  // any that don't add up to exactly kernel_half.
-  for (int phase = blip_res / 2; --phase >= 0;) {
-    int const fwd = phase * half_width;
-    int const rev = size - half_width - fwd;
+  // Default eq at full volume has a kernel built at compile time
+  blip_eq_t const def(blip_default_treble);
+  kernel_key_t const def_key = {
+      def.treble, def.kaiser, def.rolloff_freq, def.sample_rate, def.cutoff_freq, width, blip_res, 0};
+  if (key == def_key && default_kernel(width, phases, kernel_unit)) {
+    kernel_.reset();
+    return;
+  }
 
-    int error = kernel_unit;
-    for (int i = half_width; --i >= 0;) {
-      error += phases[fwd + i];
-      error += phases[rev + i];
+  // Entries don't keep kernels alive, so a kernel is freed once its last synth goes away
+  struct entry_t {
+    std::weak_ptr<short[]> kernel;
+    int unit;
+  };
+  static std::mutex mutex;
+  static std::map<kernel_key_t, entry_t> cache;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  entry_t& entry = cache[key];
+  std::shared_ptr<short[]> kernel = entry.kernel.lock();
+  if (kernel == nullptr) {
+    kernel.reset(new short[key.res / 2 * key.width]);
+    std::vector<float> fimpulse(blip_eq_t::calc_count(key.width, key.res));
+    gen_eq(fimpulse.data(), (int)fimpulse.size(), key.res, key.treble, key.rolloff_freq, key.sample_rate,
+           key.cutoff_freq, key.kaiser);
+    entry.unit = gen_kernel(fimpulse.data(), key.width, key.res, kernel.get()) >> key.shift;
+    if (key.shift != 0) {
+      rescale_kernel(kernel.get(), key.width, key.res, key.shift, entry.unit);
     }
-    phases[fwd + half_width - 1] -= (short)error;
+    entry.kernel = kernel;
 
-    // Error shouldn't occur now with improved calculation
-    // if ( error ) printf( "error: %ld\n", error );
+    std::erase_if(cache, [](auto const& item) { return item.second.kernel.expired(); });
   }
-
-#if 0
-		for ( int i = 0; i < blip_res; i++, printf( "\n" ) )
-			for ( int j = 0; j < width / 2; j++ )
-				printf( "%5d,", (int) -phases [j + width/2 * i] );
-#endif
+  kernel_ = kernel;
+  kernel_unit = entry.unit;
+  phases = kernel_.get();
 }
 
-void Blip_Synth_::rescale_kernel(int shift) {
-  // Keep values positive to avoid round-towards-zero of sign-preserving
-  // right shift for negative values.
-  int const keep_positive = 0x8000 + (1 << (shift - 1));
-
-  int const half_width = width / 2;
-  for (int phase = blip_res; --phase >= 0;) {
-    int const fwd = phase * half_width;
-
-    // Integrate, rescale, then differentiate again.
-    // If differences are rescaled directly, more error results.
-    int sum = keep_positive;
-    for (int i = 0; i < half_width; i++) {
-      int prev = sum;
-      sum += phases[fwd + i];
-      phases[fwd + i] = (sum >> shift) - (prev >> shift);
+void Blip_Synth_::treble_eq(blip_eq_t const& eq) {
+  // Derived classes might generate anything, so only plain eqs can be shared
+  bool const cacheable = typeid(eq) == typeid(blip_eq_t);
+  if (cacheable) {
+    kernel_key_t key = {eq.treble, eq.kaiser, eq.rolloff_freq, eq.sample_rate, eq.cutoff_freq, width, res, key_.shift};
+    if (cached_ && key == key_) {
+      return;  // kernel already has this eq, scaled for current volume
     }
+    cached_ = true;
+    key.shift = 0;
+    use_cached_kernel(key);
+  } else {
+    cached_ = false;
+    key_ = {};
+
+    // generate() is in terms of blip_eq_t::oversample
+    assert(res == blip_eq_t::oversample);
+    std::vector<float> fimpulse(blip_eq_t::calc_count(width));
+    eq.generate(fimpulse.data(), (int)fimpulse.size());
+    kernel_.reset(new short[impulses_size()]);
+    kernel_unit = gen_kernel(fimpulse.data(), width, res, kernel_.get());
+    phases = kernel_.get();
   }
 
-  adjust_impulse();
+  // volume might require rescaling
+  double vol = volume_unit_;
+  if (vol != 0.0) {
+    volume_unit_ = 0.0;
+    volume_unit(vol);
+  }
 }
 
 void Blip_Synth_::volume_unit(double new_unit) {
   if (volume_unit_ != new_unit) {
     // use default eq if it hasn't been set yet
     if (kernel_unit == 0) {
-      treble_eq(-8.0);
+      treble_eq(blip_default_treble);
     }
 
     // Factor that kernel must be multiplied by
@@ -453,10 +1033,20 @@ void Blip_Synth_::volume_unit(double new_unit) {
       }
 
       if (shift != 0) {
-        kernel_unit >>= shift;
+        if (cached_) {
+          // Shared kernel is regenerated with total shift rather than modified
+          kernel_key_t key = key_;
+          key.shift += shift;
+          use_cached_kernel(key);
+        } else {
+          kernel_unit >>= shift;
+          std::shared_ptr<short[]> kernel(new short[impulses_size()]);
+          memcpy(kernel.get(), phases, impulses_size() * sizeof *phases);
+          rescale_kernel(kernel.get(), width, res, shift, kernel_unit);
+          kernel_ = kernel;
+          phases = kernel_.get();
+        }
         assert(kernel_unit > 0);  // fails if volume unit is too low
-
-        rescale_kernel(shift);
       }
     }
 
@@ -464,4 +1054,10 @@ void Blip_Synth_::volume_unit(double new_unit) {
     // printf( "delta_factor: %d, kernel_unit: %d\n", delta_factor, kernel_unit );
   }
 }
-#endif
+
+int Blip_Synth_::scaled_delta_factor(double gain) const {
+  if (kernel_unit == 0) {
+    return 0;
+  }
+  return -(int)floor(volume_unit_ * gain * (1 << blip_sample_bits) / kernel_unit + 0.5);
+}
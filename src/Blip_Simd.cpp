@@ -0,0 +1,175 @@
+#include "Blip_Simd.h"
+
+/* Copyright (C) 2003-2008 Shay Green. This module is free software; you
+can redistribute it and/or modify it under the terms of the GNU Lesser
+General Public License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version. This
+module is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+details. You should have received a copy of the GNU Lesser General Public
+License along with this module; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
+
+#if BLIP_SIMD_SSE2 && !BLIP_SIMD_SSE4
+#include <emmintrin.h>
+#endif
+
+//// blip_integrate_lanes
+
+static void integrate_scalar(int const* in, short* out, int& sum_io, int bass, int count) {
+  int sum = sum_io;
+  for (int i = 0; i < count; i++) {
+    int s = sum >> 14;  // Blip_Buffer::delta_bits
+    sum -= sum >> bass;
+    sum += in[i];
+    if ((short)s != s) {
+      s = (s >> 31) ^ 0x7FFF;
+    }
+    out[i] = (short)s;
+  }
+  sum_io = sum;
+}
+
+void blip_integrate_lanes(int const* const in[], short* const out[], int sums[], int bass, int count) {
+  int i = 0;
+
+#if BLIP_SIMD_SSE2
+  // Each vector holds one sample from each of the four buffers. Four samples are read from
+  // each buffer at a time, transposed, integrated, then transposed back when written.
+  __m128i const shift = _mm_cvtsi32_si128(bass);
+  __m128i sum = _mm_loadu_si128((__m128i const*)sums);
+  for (; i + 4 <= count; i += 4) {
+    __m128i const a0 = _mm_loadu_si128((__m128i const*)(in[0] + i));
+    __m128i const a1 = _mm_loadu_si128((__m128i const*)(in[1] + i));
+    __m128i const a2 = _mm_loadu_si128((__m128i const*)(in[2] + i));
+    __m128i const a3 = _mm_loadu_si128((__m128i const*)(in[3] + i));
+
+    __m128i const t0 = _mm_unpacklo_epi32(a0, a1);
+    __m128i const t1 = _mm_unpacklo_epi32(a2, a3);
+    __m128i const t2 = _mm_unpackhi_epi32(a0, a1);
+    __m128i const t3 = _mm_unpackhi_epi32(a2, a3);
+
+#define BLIP_INTEGRATE(s, delta)                                             \
+  __m128i const s = _mm_srai_epi32(sum, 14);                                 \
+  sum = _mm_add_epi32(_mm_sub_epi32(sum, _mm_sra_epi32(sum, shift)), delta);
+
+    BLIP_INTEGRATE(s0, _mm_unpacklo_epi64(t0, t1))
+    BLIP_INTEGRATE(s1, _mm_unpackhi_epi64(t0, t1))
+    BLIP_INTEGRATE(s2, _mm_unpacklo_epi64(t2, t3))
+    BLIP_INTEGRATE(s3, _mm_unpackhi_epi64(t2, t3))
+#undef BLIP_INTEGRATE
+
+    // saturating pack does the clamping
+    __m128i const p01 = _mm_packs_epi32(s0, s1);
+    __m128i const p23 = _mm_packs_epi32(s2, s3);
+    __m128i const u = _mm_unpacklo_epi16(p01, _mm_srli_si128(p01, 8));
+    __m128i const v = _mm_unpacklo_epi16(p23, _mm_srli_si128(p23, 8));
+    __m128i const lo = _mm_unpacklo_epi32(u, v);
+    __m128i const hi = _mm_unpackhi_epi32(u, v);
+    _mm_storel_epi64((__m128i*)(out[0] + i), lo);
+    _mm_storel_epi64((__m128i*)(out[1] + i), _mm_srli_si128(lo, 8));
+    _mm_storel_epi64((__m128i*)(out[2] + i), hi);
+    _mm_storel_epi64((__m128i*)(out[3] + i), _mm_srli_si128(hi, 8));
+  }
+  _mm_storeu_si128((__m128i*)sums, sum);
+#elif BLIP_SIMD_NEON
+  int32x4_t const shift = vdupq_n_s32(-bass);
+  int32x4_t sum = vld1q_s32(sums);
+  for (; i + 4 <= count; i += 4) {
+    int32x4x2_t const t01 = vtrnq_s32(vld1q_s32(in[0] + i), vld1q_s32(in[1] + i));
+    int32x4x2_t const t23 = vtrnq_s32(vld1q_s32(in[2] + i), vld1q_s32(in[3] + i));
+
+#define BLIP_INTEGRATE(s, delta)                    \
+  int16x4_t const s = vqmovn_s32(vshrq_n_s32(sum, 14)); \
+  sum = vaddq_s32(vsubq_s32(sum, vshlq_s32(sum, shift)), delta);
+
+    BLIP_INTEGRATE(s0, vcombine_s32(vget_low_s32(t01.val[0]), vget_low_s32(t23.val[0])))
+    BLIP_INTEGRATE(s1, vcombine_s32(vget_low_s32(t01.val[1]), vget_low_s32(t23.val[1])))
+    BLIP_INTEGRATE(s2, vcombine_s32(vget_high_s32(t01.val[0]), vget_high_s32(t23.val[0])))
+    BLIP_INTEGRATE(s3, vcombine_s32(vget_high_s32(t01.val[1]), vget_high_s32(t23.val[1])))
+#undef BLIP_INTEGRATE
+
+    int16x4x2_t const u = vtrn_s16(s0, s1);
+    int16x4x2_t const v = vtrn_s16(s2, s3);
+    int32x2x2_t const w0 = vtrn_s32(vreinterpret_s32_s16(u.val[0]), vreinterpret_s32_s16(v.val[0]));
+    int32x2x2_t const w1 = vtrn_s32(vreinterpret_s32_s16(u.val[1]), vreinterpret_s32_s16(v.val[1]));
+    vst1_s16(out[0] + i, vreinterpret_s16_s32(w0.val[0]));
+    vst1_s16(out[1] + i, vreinterpret_s16_s32(w1.val[0]));
+    vst1_s16(out[2] + i, vreinterpret_s16_s32(w0.val[1]));
+    vst1_s16(out[3] + i, vreinterpret_s16_s32(w1.val[1]));
+  }
+  vst1q_s32(sums, sum);
+#endif
+
+  for (int n = 0; n < blip_lane_count; n++) {
+    integrate_scalar(in[n] + i, out[n] + i, sums[n], bass, count - i);
+  }
+}
+
+void blip_integrate_stereo(int const* const in[], short out[], int sums[], int bass, int count) {
+  int i = 0;
+  int left_sum = sums[0];
+  int right_sum = sums[1];
+  int center_sum = sums[2];
+
+#if BLIP_SIMD_SSE2
+  // Lanes hold left, right, center, and an unused zero
+  __m128i const shift = _mm_cvtsi32_si128(bass);
+  __m128i const zero = _mm_setzero_si128();
+  __m128i sum = _mm_setr_epi32(left_sum, right_sum, center_sum, 0);
+  for (; i + 4 <= count; i += 4) {
+    __m128i const a0 = _mm_loadu_si128((__m128i const*)(in[0] + i));
+    __m128i const a1 = _mm_loadu_si128((__m128i const*)(in[1] + i));
+    __m128i const a2 = _mm_loadu_si128((__m128i const*)(in[2] + i));
+
+    __m128i const t0 = _mm_unpacklo_epi32(a0, a1);
+    __m128i const t1 = _mm_unpacklo_epi32(a2, zero);
+    __m128i const t2 = _mm_unpackhi_epi32(a0, a1);
+    __m128i const t3 = _mm_unpackhi_epi32(a2, zero);
+
+#define BLIP_INTEGRATE(s, delta)                                                                     \
+  __m128i const s = _mm_srai_epi32(_mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 2, 2, 2))), 14); \
+  sum = _mm_add_epi32(_mm_sub_epi32(sum, _mm_sra_epi32(sum, shift)), delta);
+
+    BLIP_INTEGRATE(s0, _mm_unpacklo_epi64(t0, t1))
+    BLIP_INTEGRATE(s1, _mm_unpackhi_epi64(t0, t1))
+    BLIP_INTEGRATE(s2, _mm_unpacklo_epi64(t2, t3))
+    BLIP_INTEGRATE(s3, _mm_unpackhi_epi64(t2, t3))
+#undef BLIP_INTEGRATE
+
+    // low two lanes of each are the output pair
+    __m128i const pairs = _mm_packs_epi32(_mm_unpacklo_epi64(s0, s1), _mm_unpacklo_epi64(s2, s3));
+    _mm_storeu_si128((__m128i*)(out + i * 2), pairs);
+  }
+  left_sum = _mm_cvtsi128_si32(sum);
+  right_sum = _mm_cvtsi128_si32(_mm_srli_si128(sum, 4));
+  center_sum = _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+#endif
+
+  for (; i < count; i++) {
+    int l = (center_sum + left_sum) >> 14;
+    int r = (center_sum + right_sum) >> 14;
+
+    left_sum -= left_sum >> bass;
+    right_sum -= right_sum >> bass;
+    center_sum -= center_sum >> bass;
+
+    left_sum += in[0][i];
+    right_sum += in[1][i];
+    center_sum += in[2][i];
+
+    if ((short)l != l) {
+      l = (l >> 31) ^ 0x7FFF;
+    }
+    if ((short)r != r) {
+      r = (r >> 31) ^ 0x7FFF;
+    }
+    out[i * 2] = (short)l;
+    out[i * 2 + 1] = (short)r;
+  }
+
+  sums[0] = left_sum;
+  sums[1] = right_sum;
+  sums[2] = center_sum;
+}
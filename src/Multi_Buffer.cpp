@@ -12,6 +12,7 @@ License along with this module; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
 
 #include <algorithm>
+#include <cstring>
 
 Multi_Buffer::Multi_Buffer(int spf)
     : length_(0),
@@ -58,6 +59,12 @@ std::error_condition Mono_Buffer::set_sample_rate(int rate, int msec) {
   return Multi_Buffer::set_sample_rate(buf.sample_rate(), buf.length());
 }
 
+int Mono_Buffer::read_samples_planar(float left[], float right[], int count) {
+  count = buf.read_samples_float(left, count);
+  memcpy(right, left, count * sizeof *right);
+  return count;
+}
+
 // Tracked_Blip_Buffer
 
 int const blip_buffer_extra = 32;  // TODO: explain why this value
@@ -78,8 +85,15 @@ void Tracked_Blip_Buffer::end_frame(blip_time_t t) {
   }
 }
 
+void Tracked_Blip_Buffer::restore_state(void const* in, size_t size) {
+  Blip_Buffer::restore_state(in, size);
+  last_non_silence = samples_avail() + blip_buffer_extra;  // not captured, so assume all unread are non-silent
+}
+
+// As a tap, frames are ended by Blip_Buffer::end_frame(), which leaves the modified flag
+// set, so a modified tap is always treated as non-silent
 unsigned Tracked_Blip_Buffer::non_silent() const {
-  return last_non_silence | unsettled();
+  return last_non_silence | unsettled() | (unsigned)modified();
 }
 
 inline void Tracked_Blip_Buffer::remove_(int n) {
@@ -108,9 +122,65 @@ void Tracked_Blip_Buffer::remove_all_samples() {
   }
 }
 
+// True if deltas are all zero. This looks at the deltas themselves rather than relying on
+// set_modified(), and is much cheaper than integrating them.
+static bool zero_deltas(Blip_Buffer::delta_t const* in, int count) {
+  Blip_Buffer::delta_t any = 0;
+  for (int i = 0; i < count; i++) {
+    any |= in[i];
+  }
+  return any == 0;
+}
+
+// True if sum no longer changes when integrating zero deltas
+static bool settled(int sum, int bass) {
+  return (sum >> bass) == 0;
+}
+
 int Tracked_Blip_Buffer::read_samples(blip_sample_t out[], int count) {
-  count = Blip_Buffer::read_samples(out, count);
-  remove_(count);
+  count = std::min(count, samples_avail());
+  if (!zero_deltas(read_pos(), count)) {
+    count = Blip_Buffer::read_samples(out, count);
+    remove_(count);
+    return count;
+  }
+
+  // Only the integrator needs to be run until it settles, then output is constant
+  int const bass = highpass_shift();
+  int sum = integrator();
+  int i = 0;
+  for (; i < count && !settled(sum, bass); i++) {
+    int s = sum >> delta_bits;
+    sum -= sum >> bass;
+    BLIP_CLAMP(s, s);
+    out[i] = (blip_sample_t)s;
+  }
+  int s = sum >> delta_bits;
+  BLIP_CLAMP(s, s);
+  std::fill(out + i, out + count, (blip_sample_t)s);
+  set_integrator(sum);
+  remove_samples(count);
+  return count;
+}
+
+int Tracked_Blip_Buffer::read_samples_float(float out[], int count) {
+  count = std::min(count, samples_avail());
+  if (!zero_deltas(read_pos(), count)) {
+    count = Blip_Buffer::read_samples_float(out, count);
+    remove_(count);
+    return count;
+  }
+
+  int const bass = highpass_shift();
+  int sum = integrator();
+  int i = 0;
+  for (; i < count && !settled(sum, bass); i++) {
+    out[i] = (float)sum * blip_sample_float_scale;
+    sum -= sum >> bass;
+  }
+  std::fill(out + i, out + count, (float)sum * blip_sample_float_scale);
+  set_integrator(sum);
+  remove_samples(count);
   return count;
 }
 
@@ -138,6 +208,12 @@ std::error_condition Stereo_Buffer::set_sample_rate(int rate, int msec) {
   return Multi_Buffer::set_sample_rate(bufs[0].sample_rate(), bufs[0].length());
 }
 
+void Stereo_Buffer::memory_resource(std::pmr::memory_resource* resource) {
+  for (int i = bufs_size; --i >= 0;) {
+    bufs[i].memory_resource(resource);
+  }
+}
+
 void Stereo_Buffer::clock_rate(int rate) {
   for (int i = bufs_size; --i >= 0;) {
     bufs[i].clock_rate(rate);
@@ -150,6 +226,12 @@ void Stereo_Buffer::bass_freq(int bass) {
   }
 }
 
+void Stereo_Buffer::exact_ratio(bool enabled) {
+  for (int i = bufs_size; --i >= 0;) {
+    bufs[i].exact_ratio(enabled);
+  }
+}
+
 void Stereo_Buffer::clear() {
   mixer.samples_read = 0;
   for (int i = bufs_size; --i >= 0;) {
@@ -170,22 +252,46 @@ int Stereo_Buffer::read_samples(blip_sample_t out[], int out_size) {
   int pair_count = (out_size >> 1);
   if (pair_count != 0) {
     mixer.read_pairs(out, pair_count);
+    remove_mixed_samples();
+  }
+  return out_size;
+}
 
-    if (samples_avail() <= 0 || immediate_removal()) {
-      for (int i = bufs_size; --i >= 0;) {
-        buf_t& b = bufs[i];
-        // TODO: might miss non-silence settling since it checks END of last read
-        if (b.non_silent() == 0u) {
-          b.remove_silence(mixer.samples_read);
-        }
-        else {
-          b.remove_samples(mixer.samples_read);
-        }
+int Stereo_Buffer::read_samples_float(float out[], int out_size) {
+  assert((out_size & 1) == 0);  // must read an even number of samples
+  out_size = std::min(out_size, samples_avail());
+
+  int pair_count = (out_size >> 1);
+  if (pair_count != 0) {
+    mixer.read_pairs_float(out, out + 1, stereo, pair_count);
+    remove_mixed_samples();
+  }
+  return out_size;
+}
+
+int Stereo_Buffer::read_samples_planar(float left[], float right[], int count) {
+  count = std::min(count, samples_avail() >> 1);
+  if (count != 0) {
+    mixer.read_pairs_float(left, right, 1, count);
+    remove_mixed_samples();
+  }
+  return count;
+}
+
+void Stereo_Buffer::remove_mixed_samples() {
+  if (samples_avail() <= 0 || immediate_removal()) {
+    for (int i = bufs_size; --i >= 0;) {
+      buf_t& b = bufs[i];
+      // TODO: might miss non-silence settling since it checks END of last read
+      if (b.non_silent() == 0u) {
+        b.remove_silence(mixer.samples_read);
+      }
+      else {
+        b.remove_samples(mixer.samples_read);
       }
-      mixer.samples_read = 0;
     }
+    mixer.samples_read = 0;
   }
-  return out_size;
 }
 
 // Stereo_Mixer
@@ -201,6 +307,9 @@ void Stereo_Mixer::read_pairs(blip_sample_t out[], int count) {
   if ((bufs[0]->non_silent() | bufs[1]->non_silent()) != 0u) {
     mix_stereo(out, count);
   }
+  else if (zero_deltas(bufs[2]->read_pos() + samples_read - count, count)) {
+    mix_silence(out, count);
+  }
   else {
     mix_mono(out, count);
   }
@@ -229,47 +338,127 @@ void Stereo_Mixer::mix_mono(blip_sample_t out_[], int count) {
   bufs[2]->set_integrator(center_sum);
 }
 
-void Stereo_Mixer::mix_stereo(blip_sample_t out_[], int count) {
-  blip_sample_t* __restrict out = out_ + count * stereo;
+void Stereo_Mixer::mix_stereo(blip_sample_t out[], int count) {
+  // left, right, and center are integrated together so center is only integrated once
+  Blip_Buffer::delta_t const* in[3];
+  int sums[3];
+  for (int i = 0; i < 3; i++) {
+    in[i] = bufs[i]->read_pos() + samples_read - count;
+    sums[i] = bufs[i]->integrator();
+  }
+
+  blip_integrate_stereo(in, out, sums, bufs[2]->highpass_shift(), count);
+
+  for (int i = 0; i < 3; i++) {
+    bufs[i]->set_integrator(sums[i]);
+  }
+}
+
+void Stereo_Mixer::read_pairs_float(float left[], float right[], int stride, int count) {
+  samples_read += count;
+  if ((bufs[0]->non_silent() | bufs[1]->non_silent()) != 0u) {
+    mix_stereo_float(left, right, stride, count);
+  }
+  else if (zero_deltas(bufs[2]->read_pos() + samples_read - count, count)) {
+    mix_silence_float(left, right, stride, count);
+  }
+  else {
+    mix_mono_float(left, right, stride, count);
+  }
+}
+
+void Stereo_Mixer::mix_mono_float(float left_[], float right_[], int stride, int count) {
+  int const bass = bufs[2]->highpass_shift();
+  Blip_Buffer::delta_t const* center = bufs[2]->read_pos() + samples_read;
+  int center_sum = bufs[2]->integrator();
+
+  float* __restrict left = left_ + count * stride;
+  float* __restrict right = right_ + count * stride;
+  int offset = -count;
+  do {
+    float s = (float)center_sum * blip_sample_float_scale;
+
+    center_sum -= center_sum >> bass;
+    center_sum += center[offset];
+
+    left[offset * stride] = s;
+    right[offset * stride] = s;
+  } while (++offset != 0);
+
+  bufs[2]->set_integrator(center_sum);
+}
+
+void Stereo_Mixer::mix_stereo_float(float left_[], float right_[], int stride, int count) {
+  // no clamping is needed, so both sides can be mixed in one pass
+  int const bass = bufs[2]->highpass_shift();
+  Blip_Buffer::delta_t const* left_in = bufs[0]->read_pos() + samples_read;
+  Blip_Buffer::delta_t const* right_in = bufs[1]->read_pos() + samples_read;
+  Blip_Buffer::delta_t const* center = bufs[2]->read_pos() + samples_read;
 
-  // do left + center and right + center separately to reduce register load
-  Tracked_Blip_Buffer* const* buf = &bufs[2];
-  while (true)  // loop runs twice
-  {
-    --buf;
-    --out;
+  int left_sum = bufs[0]->integrator();
+  int right_sum = bufs[1]->integrator();
+  int center_sum = bufs[2]->integrator();
 
-    int const bass = bufs[2]->highpass_shift();
-    Blip_Buffer::delta_t const* side = (*buf)->read_pos() + samples_read;
-    Blip_Buffer::delta_t const* center = bufs[2]->read_pos() + samples_read;
+  float* __restrict left = left_ + count * stride;
+  float* __restrict right = right_ + count * stride;
+  int offset = -count;
+  do {
+    left[offset * stride] = (float)(center_sum + left_sum) * blip_sample_float_scale;
+    right[offset * stride] = (float)(center_sum + right_sum) * blip_sample_float_scale;
 
-    int side_sum = (*buf)->integrator();
-    int center_sum = bufs[2]->integrator();
+    left_sum -= left_sum >> bass;
+    right_sum -= right_sum >> bass;
+    center_sum -= center_sum >> bass;
 
-    int offset = -count;
-    do {
-      int s = (center_sum + side_sum) >> Blip_Buffer::delta_bits;
+    left_sum += left_in[offset];
+    right_sum += right_in[offset];
+    center_sum += center[offset];
+  } while (++offset != 0);
 
-      side_sum -= side_sum >> bass;
-      center_sum -= center_sum >> bass;
+  bufs[0]->set_integrator(left_sum);
+  bufs[1]->set_integrator(right_sum);
+  bufs[2]->set_integrator(center_sum);
+}
 
-      side_sum += side[offset];
-      center_sum += center[offset];
+// Center deltas are all zero, so its integrator only decays until it settles, after which
+// output is constant. Gives the same output as mix_mono() would.
+void Stereo_Mixer::mix_silence(blip_sample_t out[], int count) {
+  int const bass = bufs[2]->highpass_shift();
+  int center_sum = bufs[2]->integrator();
 
-      BLIP_CLAMP(s, s);
+  int i = 0;
+  for (; i < count && !settled(center_sum, bass); i++) {
+    int s = center_sum >> Tracked_Blip_Buffer::delta_bits;
+    center_sum -= center_sum >> bass;
+    BLIP_CLAMP(s, s);
+    out[i * 2] = (blip_sample_t)s;
+    out[i * 2 + 1] = (blip_sample_t)s;
+  }
 
-      ++offset;  // before write since out is decremented to slightly before end
-      out[offset * stereo] = (blip_sample_t)s;
-    } while (offset != 0);
+  int s = center_sum >> Tracked_Blip_Buffer::delta_bits;
+  BLIP_CLAMP(s, s);
+  std::fill(out + i * 2, out + count * 2, (blip_sample_t)s);
 
-    (*buf)->set_integrator(side_sum);
+  bufs[2]->set_integrator(center_sum);
+}
 
-    if (buf != bufs) {
-      continue;
-    }
+void Stereo_Mixer::mix_silence_float(float left[], float right[], int stride, int count) {
+  int const bass = bufs[2]->highpass_shift();
+  int center_sum = bufs[2]->integrator();
+
+  int i = 0;
+  for (; i < count && !settled(center_sum, bass); i++) {
+    float s = (float)center_sum * blip_sample_float_scale;
+    center_sum -= center_sum >> bass;
+    left[i * stride] = s;
+    right[i * stride] = s;
+  }
 
-    // only end center once
-    bufs[2]->set_integrator(center_sum);
-    break;
+  float const s = (float)center_sum * blip_sample_float_scale;
+  for (; i < count; i++) {
+    left[i * stride] = s;
+    right[i * stride] = s;
   }
+
+  bufs[2]->set_integrator(center_sum);
 }
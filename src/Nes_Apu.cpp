@@ -14,6 +14,8 @@
 
 #include "Nes_Apu.h"
 
+#include <algorithm>
+
 int const amp_range = 15;
 
 Nes_Apu::Nes_Apu() : square1(&square_synth), square2(&square_synth) {
@@ -77,6 +79,16 @@ void Nes_Apu::set_tempo(double t) {
   }
 }
 
+void Nes_Apu::fast_forward(nes_time_t time, bool enabled) {
+  run_until_(time);
+  fast_forward_ = enabled;
+
+  // oscillators without output already only keep their state up to date
+  for (int i = 0; i < osc_count; ++i) {
+    oscs[i]->output = enabled ? nullptr : outputs[i];
+  }
+}
+
 void Nes_Apu::reset(bool pal_mode, uint8_t initial_dmc_dac) {
   dmc.pal_mode = pal_mode;
   set_tempo(tempo_);
@@ -266,22 +278,117 @@ void Nes_Apu::end_frame(blip_time_t end_time) {
   }
 }
 
+int Nes_Apu::render(Blip_Buffer& buf, blip_sample_t out[], int count) {
+  if (buf.samples_avail() < count) {
+    nes_time_t const end_time = buf.count_clocks(count);
+    end_frame(end_time);
+    if (end_frame_notifier) {
+      end_frame_notifier(end_time);
+    }
+    buf.end_frame(end_time);
+  }
+  return buf.read_samples(out, count);
+}
+
 // registers
 
 static const unsigned char length_table[0x20] = {0x0A, 0xFE, 0x14, 0x02, 0x28, 0x04, 0x50, 0x06, 0xA0, 0x08, 0x3C,
                                                  0x0A, 0x0E, 0x0C, 0x1A, 0x0E, 0x0C, 0x10, 0x18, 0x12, 0x30, 0x14,
                                                  0x60, 0x16, 0xC0, 0x18, 0x48, 0x1A, 0x10, 0x1C, 0x20, 0x1E};
 
+// True if addr is one of the APU's registers, rather than outside them
+static bool is_io_addr(uint16_t addr) {
+  return addr >= Nes_Apu::io_addr && addr < int(Nes_Apu::io_addr) + Nes_Apu::io_size;
+}
+
 void Nes_Apu::write_register(blip_time_t time, uint16_t addr, uint8_t data) {
   assert(addr > 0x20);  // addr must be actual address (i.e. 0x40xx)
 
   // Ignore addresses outside range
-  if ((addr < io_addr) || addr > (io_addr + io_size)) {
+  if (!is_io_addr(addr)) {
     return;
   }
 
   run_until_(time);
+  write_register_(time, addr, data);
+}
+
+inline void Nes_Apu::run_osc(int index, blip_time_t time, blip_time_t end_time) {
+  switch (index) {
+    case 0:
+      square1.run(time, end_time);
+      break;
+    case 1:
+      square2.run(time, end_time);
+      break;
+    case 2:
+      triangle.run(time, end_time);
+      break;
+    case 3:
+      noise.run(time, end_time);
+      break;
+  }
+}
+
+void Nes_Apu::write_registers(reg_write_t const writes[], int count) {
+  // Square, triangle and noise can each be run past last_time, up to the next frame
+  // counter clock
+  blip_time_t osc_time[4] = {last_time, last_time, last_time, last_time};
+  blip_time_t synced = last_time;  // latest of osc_time
+
+  // Brings all of them to synced and makes it the new last_time
+  auto sync_oscs = [&] {
+    for (int n = 0; n < 4; n++) {
+      if (osc_time[n] < synced) {
+        run_osc(n, osc_time[n], synced);
+        osc_time[n] = synced;
+      }
+    }
+    frame_delay -= synced - last_time;
+    last_time = synced;
+  };
+
+  for (int i = 0; i < count; i++) {
+    blip_time_t const time = writes[i].time;
+    uint16_t const addr = writes[i].addr;
+    assert(addr > 0x20);                           // addr must be actual address (i.e. 0x40xx)
+    assert(i == 0 || time >= writes[i - 1].time);  // writes must be sorted
+
+    if (!is_io_addr(addr)) {
+      continue;
+    }
+
+    if (addr < 0x4010 && time <= last_time + frame_delay) {
+      // Only affects this oscillator, and no frame counter clock comes first
+      int const osc_index = (addr - io_addr) >> 2;
+      if (osc_time[osc_index] < time) {
+        run_osc(osc_index, osc_time[osc_index], time);
+        osc_time[osc_index] = time;
+        synced = std::max(synced, time);
+      }
+    }
+    else if (addr >= 0x4010 && addr < 0x4014) {
+      // DMC runs separately from the frame counter
+      if (last_dmc_time < time) {
+        blip_time_t start = last_dmc_time;
+        last_dmc_time = time;
+        dmc.run(start, time);
+      }
+    }
+    else {
+      sync_oscs();
+      run_until_(time);
+      std::fill_n(osc_time, 4, time);
+      synced = time;
+    }
 
+    write_register_(time, addr, writes[i].data);
+  }
+
+  sync_oscs();
+}
+
+void Nes_Apu::write_register_(blip_time_t time, uint16_t addr, uint8_t data) {
   if (addr < 0x4014) {
     // Write to channel
     int osc_index = (addr - io_addr) >> 2;
@@ -360,7 +467,17 @@ void Nes_Apu::write_register(blip_time_t time, uint16_t addr, uint8_t data) {
 }
 
 uint8_t Nes_Apu::read_status(blip_time_t time) {
-  run_until_(time - 1);
+  // Status only changes at frame counter clocks and DMC reads, so oscillators are run only
+  // if a frame counter clock comes first, and the DMC only if it reads
+  bool const frame_clocked = last_time + frame_delay < time;
+  if (frame_clocked) {
+    run_until_(time - 1);
+  }
+  else if (last_dmc_time < time - 1 && time - 1 > next_dmc_read_time()) {
+    blip_time_t start = last_dmc_time;
+    last_dmc_time = time - 1;
+    dmc.run(start, time - 1);
+  }
 
   uint8_t result = (static_cast<int>(dmc.irq_flag) << 7) | (static_cast<int>(irq_flag) << 6);
 
@@ -370,7 +487,9 @@ uint8_t Nes_Apu::read_status(blip_time_t time) {
     }
   }
 
-  run_until_(time);
+  if (frame_clocked) {
+    run_until_(time);
+  }
 
   if (irq_flag) {
     result |= 0x40;
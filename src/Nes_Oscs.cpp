@@ -355,8 +355,14 @@ void Nes_Dmc::start() {
 
 void Nes_Dmc::fill_buffer() {
   if (!buf_full && (length_counter != 0)) {
-    assert(apu->dmc_reader);  // dmc_reader must be set
-    buf = apu->dmc_reader(0x8000u + address);
+    if (apu->dmc_banks != nullptr) {
+      int const shift = apu->dmc_bank_shift;
+      buf = apu->dmc_banks[address >> shift][address & ((1 << shift) - 1)];
+    }
+    else {
+      assert(apu->dmc_reader);  // dmc_reader or dmc_memory() must be set
+      buf = apu->dmc_reader(0x8000u + address);
+    }
     address = (address + 1) & 0x7FFF;
     buf_full = true;
     if (--length_counter == 0) {
@@ -386,8 +392,17 @@ void Nes_Dmc::run(nes_time_t time, nes_time_t end_time) {
   time += delay;
   if (time < end_time) {
     int bits_remain = this->bits_remain;
-    if (silence && !buf_full) {
+    if ((silence && !buf_full) || output == nullptr) {
       int count = (end_time - time + period - 1) / period;
+
+      // Without output, bits are never played, so only the byte boundaries where the
+      // buffered byte is taken and the next one read matter
+      for (int n = count - bits_remain; n >= 0 && buf_full; n -= 8) {
+        bits = buf;
+        buf_full = false;
+        fill_buffer();
+      }
+
       bits_remain = (bits_remain - 1 + 8 - (count % 8)) % 8 + 1;
       time += count * period;
     }
@@ -396,9 +411,7 @@ void Nes_Dmc::run(nes_time_t time, nes_time_t end_time) {
       const int period = this->period;
       int bits = this->bits;
       int dac = this->dac;
-      if (output != nullptr) {
-        output->set_modified();
-      }
+      output->set_modified();
 
       do {
         if (!silence) {
@@ -421,9 +434,6 @@ void Nes_Dmc::run(nes_time_t time, nes_time_t end_time) {
             silence = false;
             bits = buf;
             buf_full = false;
-            if (output == nullptr) {
-              silence = true;
-            }
             fill_buffer();
           }
         }
@@ -497,6 +507,9 @@ void Nes_Noise::run(nes_time_t time, nes_time_t end_time) {
           // bits 0 and 1 of noise differ
           delta = -delta;
           synth.offset_resampled(rtime, delta, output);
+          if (output->next_tap() != nullptr) {
+            synth.offset_taps(time - period, delta, output);
+          }
         }
 
         rtime += rperiod;
@@ -159,13 +159,15 @@ void Nes_Vrc7_Apu::run_until(blip_time_t end_time) {
   */
   // optimal case
   do {
-    int amp = OPLL_calc((OPLL*)this->opll);
-    int delta = amp - mono.last_amp;
-    if (delta != 0) {
-      mono.last_amp = amp;
-      synth.offset_inline(time, delta, mono.output);
-    }
-    time += period;
+    // generate a block of samples, then add them all at once
+    int amps[64];
+    int count = 0;
+    blip_time_t const start = time;
+    do {
+      amps[count++] = OPLL_calc((OPLL*)this->opll);
+      time += period;
+    } while (count < (int)(sizeof amps / sizeof *amps) && time < end_time);
+    mono.last_amp = synth.offset_pcm(start, period, amps, count, mono.last_amp, mono.output);
   } while (time < end_time);
   /*
   }
@@ -0,0 +1,124 @@
+// Pins $4015 reads and IRQ timing around frame counter and DMC IRQs
+
+#include "Nes_Apu.h"
+
+#include <cstdio>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, int time) {
+  if (!ok) {
+    std::printf("FAILED: %s at %d\n", what, time);
+    failures++;
+  }
+}
+
+static int silent_dmc_reader(int) {
+  return 0;
+}
+
+static void init(Nes_Apu& apu) {
+  apu.dmc_reader = &silent_dmc_reader;
+  apu.reset();
+}
+
+// 4-step mode with IRQ enabled sets the frame IRQ flag once per 29830 clocks. Reading
+// $4015 returns and clears it.
+static void test_frame_irq() {
+  Nes_Apu apu;
+  init(apu);
+  apu.write_register(0, 0x4017, 0x00);
+  check(apu.earliest_irq(0) == 29834, "frame IRQ time", 0);
+
+  for (int t = 29820; t < 29832; t++) {
+    check(apu.read_status(t) == 0x00, "no frame IRQ before boundary", t);
+  }
+  check(apu.read_status(29832) == 0x40, "frame IRQ at boundary", 29832);
+  check(apu.earliest_irq(29832) == 59665, "next frame IRQ time", 29832);
+  check(apu.read_status(29833) == 0x00, "frame IRQ cleared by read", 29833);
+}
+
+// Same boundary seen by a loop polling $4015 every 7 clocks
+static void test_frame_irq_polled() {
+  Nes_Apu apu;
+  init(apu);
+  apu.write_register(0, 0x4017, 0x00);
+
+  int first = -1;
+  for (int t = 29000; t <= 31000 && first < 0; t += 7) {
+    if (apu.read_status(t) & 0x40) {
+      first = t;
+    }
+  }
+  check(first == 29833, "polled frame IRQ", first);
+  check(apu.read_status(29840) == 0x00, "polled frame IRQ cleared by read", 29840);
+}
+
+static void test_frame_irq_inhibited() {
+  Nes_Apu apu;
+  init(apu);
+  apu.write_register(0, 0x4017, 0x40);
+  check(apu.earliest_irq(0) == Nes_Apu::no_irq, "inhibited frame IRQ time", 0);
+
+  for (int t = 29000; t <= 31000; t += 7) {
+    check(apu.read_status(t) == 0x00, "inhibited frame IRQ", t);
+  }
+}
+
+// Plays a 17-byte sample at the fastest rate, which reads its last byte at clock 6481
+static void start_dmc(Nes_Apu& apu, bool irq) {
+  init(apu);
+  apu.write_register(0, 0x4017, 0x40);
+  apu.write_register(0, 0x4010, irq ? 0x8F : 0x0F);
+  apu.write_register(0, 0x4013, 0x01);
+  apu.write_register(0, 0x4015, 0x10);
+}
+
+static void test_dmc_irq() {
+  Nes_Apu apu;
+  start_dmc(apu, true);
+  check(apu.earliest_irq(0) == 6481, "DMC IRQ time", 0);
+
+  for (int t = 1; t < 6482; t++) {
+    check(apu.read_status(t) == 0x10, "DMC active before last byte", t);
+  }
+  check(apu.read_status(6482) == 0x80, "DMC IRQ after last byte", 6482);
+  check(apu.earliest_irq(6482) == Nes_Apu::irq_waiting, "DMC IRQ waiting", 6482);
+  check(apu.read_status(6483) == 0x80, "DMC IRQ not cleared by read", 6483);
+
+  apu.write_register(6484, 0x4015, 0x00);
+  check(apu.read_status(6485) == 0x00, "DMC IRQ cleared by $4015 write", 6485);
+  check(apu.earliest_irq(6485) == Nes_Apu::no_irq, "DMC IRQ time after clear", 6485);
+}
+
+// Same boundary from a single read that jumps over it
+static void test_dmc_irq_skipped() {
+  Nes_Apu apu;
+  start_dmc(apu, true);
+  check(apu.read_status(100) == 0x10, "DMC active", 100);
+  check(apu.read_status(7000) == 0x80, "DMC IRQ after skipped boundary", 7000);
+}
+
+static void test_dmc_no_irq() {
+  Nes_Apu apu;
+  start_dmc(apu, false);
+  check(apu.earliest_irq(0) == Nes_Apu::no_irq, "DMC without IRQ time", 0);
+
+  check(apu.read_status(6481) == 0x10, "DMC active before last byte", 6481);
+  check(apu.read_status(6482) == 0x00, "DMC ends without IRQ", 6482);
+}
+
+int main() {
+  test_frame_irq();
+  test_frame_irq_polled();
+  test_frame_irq_inhibited();
+  test_dmc_irq();
+  test_dmc_irq_skipped();
+  test_dmc_no_irq();
+
+  if (failures) {
+    std::printf("%d checks failed\n", failures);
+    return 1;
+  }
+  return 0;
+}